@@ -38,6 +38,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -47,6 +48,7 @@
 #include <getopt.h>
 #include <utime.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <zlib.h>
 
 #include <sys/types.h>
@@ -60,6 +62,7 @@
 #include "c.h"
 #include "exitcodes.h"
 #include "closestream.h"
+#include "strutils.h"
 
 #define XALLOC_EXIT_CODE FSCK_EX_ERROR
 #include "xalloc.h"
@@ -96,6 +99,38 @@ static unsigned long read_buffer_block = ~0UL;
 
 static z_stream stream;
 
+static long opt_threads = 1;	/* number of extraction threads (-j) */
+
+/*
+ * With more than one thread the regular files are decompressed (and
+ * written) by a pool of workers, directly from the mapped image. The
+ * first job is the CRC of the image.
+ */
+struct extract_job {
+	char *path;		/* NULL for the CRC */
+	struct cramfs_inode inode;
+	struct extract_job *next;
+};
+
+#define EXTRACT_QUEUE_MAX	1024
+
+static struct extract_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;	/* a job was queued, or done */
+	pthread_cond_t space;	/* a job was taken */
+	struct extract_job *head, *tail;
+	size_t nqueued;
+	int done;
+
+	pthread_t *threads;
+	long nthreads;
+
+	const unsigned char *image;	/* mapped image */
+	int start;			/* offset of the superblock */
+	uint32_t crc;
+	unsigned long end_data;
+} pool;
+
 /* Prototypes */
 static void expand_fs(char *, struct cramfs_inode *);
 #endif /* INCLUDE_FS_TESTS */
@@ -114,6 +149,7 @@ static void __attribute__((__noreturn__)) usage(int status)
 		_(" %s [options] file\n"), program_invocation_short_name);
 	fputs(USAGE_OPTIONS, stream);
 	fputs(_(" -a                       for compatibility only, ignored\n"), stream);
+	fputs(_(" -j, --threads <num>      number of threads to check and extract files\n"), stream);
 	fputs(_(" -v, --verbose            be more verbose\n"), stream);
 	fputs(_(" -x, --destination <dir>  extract into directory\n"), stream);
 	fputs(_(" -y                       for compatibility only, ignored\n"), stream);
@@ -343,26 +379,31 @@ static struct cramfs_inode *read_super(void)
 	return root;
 }
 
-static int uncompress_block(void *src, size_t len)
+static int inflate_block(z_stream *zs, char *out, void *src, size_t len)
 {
 	int err;
 
-	stream.next_in = src;
-	stream.avail_in = len;
+	zs->next_in = src;
+	zs->avail_in = len;
 
-	stream.next_out = (unsigned char *)outbuffer;
-	stream.avail_out = page_size * 2;
+	zs->next_out = (unsigned char *)out;
+	zs->avail_out = page_size * 2;
 
-	inflateReset(&stream);
+	inflateReset(zs);
 
 	if (len > page_size * 2)
 		errx(FSCK_EX_UNCORRECTED, _("data block too large"));
 
-	err = inflate(&stream, Z_FINISH);
+	err = inflate(zs, Z_FINISH);
 	if (err != Z_STREAM_END)
 		errx(FSCK_EX_UNCORRECTED, _("decompression error: %s"),
 		     zError(err));
-	return stream.total_out;
+	return zs->total_out;
+}
+
+static int uncompress_block(void *src, size_t len)
+{
+	return inflate_block(&stream, outbuffer, src, len);
 }
 
 #if !HAVE_LCHOWN
@@ -434,6 +475,213 @@ static void change_file_status(char *path, struct cramfs_inode *i)
 		err(FSCK_EX_ERROR, _("utime failed: %s"), path);
 }
 
+/*
+ * The same as do_uncompress() and the rest of do_file(), but reading from
+ * the mapped image with a private inflate stream.
+ */
+static void extract_file(struct extract_job *job, z_stream *zs, char *buf,
+			 unsigned long *end)
+{
+	struct cramfs_inode *i = &job->inode;
+	unsigned long offset = i->offset << 2;
+	unsigned long size = i->size;
+	unsigned long curr = offset + 4 * ((size + page_size - 1) / page_size);
+	int fd = -1;
+
+	if (opt_extract) {
+		fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, i->mode);
+		if (fd < 0)
+			err(FSCK_EX_ERROR, _("cannot open %s"), job->path);
+	}
+	do {
+		unsigned long out = page_size;
+		unsigned long next;
+
+		if (offset + 4 > super.size)
+			errx(FSCK_EX_UNCORRECTED, _("invalid file data offset"));
+		next = u32_toggle_endianness(cramfs_is_big_endian,
+				*(uint32_t *) (pool.image + offset));
+		if (next > super.size)
+			errx(FSCK_EX_UNCORRECTED, _("invalid file data offset"));
+		if (next > *end)
+			*end = next;
+
+		offset += 4;
+		if (curr == next) {
+			if (size < page_size)
+				out = size;
+			memset(buf, 0x00, out);
+		} else
+			out = inflate_block(zs, buf, (void *) (pool.image + curr),
+					    next - curr);
+		if (size >= page_size) {
+			if (out != page_size)
+				errx(FSCK_EX_UNCORRECTED,
+				     _("non-block (%ld) bytes"), out);
+		} else {
+			if (out != size)
+				errx(FSCK_EX_UNCORRECTED,
+				     _("non-size (%ld vs %ld) bytes"), out,
+				     size);
+		}
+		size -= out;
+		if (opt_extract)
+			if (write(fd, buf, out) < 0)
+				err(FSCK_EX_ERROR, _("write failed: %s"),
+				    job->path);
+		curr = next;
+	} while (size);
+
+	if (opt_extract) {
+		close(fd);
+		change_file_status(job->path, i);
+	}
+}
+
+/* CRC of the mapped image, with the CRC field itself taken as zero */
+static uint32_t image_crc(void)
+{
+	const unsigned char *p = pool.image + pool.start;
+	const unsigned char zero[sizeof(super.fsid.crc)] = { 0 };
+	size_t off = offsetof(struct cramfs_super, fsid.crc);
+	uint32_t crc = crc32(0L, Z_NULL, 0);
+
+	crc = crc32(crc, p, off);
+	crc = crc32(crc, zero, sizeof(zero));
+	off += sizeof(zero);
+	return crc32(crc, p + off, super.size - pool.start - off);
+}
+
+static void *extract_worker(void *data __attribute__((__unused__)))
+{
+	z_stream zs;
+	char *buf = xmalloc(page_size * 2);
+	unsigned long end = 0;
+
+	memset(&zs, 0, sizeof(zs));
+	inflateInit(&zs);
+
+	for (;;) {
+		struct extract_job *job;
+
+		pthread_mutex_lock(&pool.lock);
+		while (!pool.head && !pool.done)
+			pthread_cond_wait(&pool.queued, &pool.lock);
+		job = pool.head;
+		if (job) {
+			pool.head = job->next;
+			if (!pool.head)
+				pool.tail = NULL;
+			pool.nqueued--;
+			pthread_cond_signal(&pool.space);
+		}
+		pthread_mutex_unlock(&pool.lock);
+		if (!job)
+			break;
+
+		if (job->path) {
+			extract_file(job, &zs, buf, &end);
+			free(job->path);
+		} else
+			pool.crc = image_crc();
+		free(job);
+	}
+
+	inflateEnd(&zs);
+	free(buf);
+
+	pthread_mutex_lock(&pool.lock);
+	if (end > pool.end_data)
+		pool.end_data = end;
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void queue_job(struct extract_job *job)
+{
+	pthread_mutex_lock(&pool.lock);
+	while (pool.nqueued >= EXTRACT_QUEUE_MAX)
+		pthread_cond_wait(&pool.space, &pool.lock);
+	if (pool.tail)
+		pool.tail->next = job;
+	else
+		pool.head = job;
+	pool.tail = job;
+	pool.nqueued++;
+	pthread_cond_signal(&pool.queued);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void queue_file(char *path, struct cramfs_inode *i)
+{
+	struct extract_job *job = xcalloc(1, sizeof(*job));
+
+	job->path = xstrdup(path);
+	job->inode = *i;
+	queue_job(job);
+}
+
+/*
+ * Map the image and start the workers. Returns 0 on success, the image
+ * is then checked by the workers and must not be tested by test_crc().
+ */
+static int start_workers(int start)
+{
+	void *buf;
+	long i;
+
+	if (!(super.flags & CRAMFS_FLAG_FSID_VERSION_2))
+		return -1;
+	buf = mmap(NULL, super.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED)
+		return -1;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.queued, NULL);
+	pthread_cond_init(&pool.space, NULL);
+	pool.image = buf;
+	pool.start = start;
+
+	pool.threads = xcalloc(opt_threads, sizeof(pthread_t));
+	for (i = 0; i < opt_threads; i++) {
+		if (pthread_create(&pool.threads[pool.nthreads], NULL,
+				   extract_worker, NULL) != 0)
+			break;
+		pool.nthreads++;
+	}
+	if (!pool.nthreads) {
+		free(pool.threads);
+		munmap(buf, super.size);
+		pool.image = NULL;
+		return -1;
+	}
+
+	queue_job(xcalloc(1, sizeof(struct extract_job)));	/* CRC */
+	return 0;
+}
+
+static void stop_workers(void)
+{
+	long i;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.done = 1;
+	pthread_cond_broadcast(&pool.queued);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.nthreads; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+
+	munmap((void *) pool.image, super.size);
+	pool.image = NULL;
+
+	if (pool.crc != super.fsid.crc)
+		errx(FSCK_EX_UNCORRECTED, _("crc error"));
+	if (pool.end_data > end_data)
+		end_data = pool.end_data;
+}
+
 static void do_directory(char *path, struct cramfs_inode *i)
 {
 	int pathlen = strlen(path);
@@ -505,6 +753,10 @@ static void do_file(char *path, struct cramfs_inode *i)
 		start_data = offset;
 	if (opt_verbose)
 		print_node('f', i, path);
+	if (pool.image && i->size) {
+		queue_file(path, i);
+		return;
+	}
 	if (opt_extract) {
 		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, i->mode);
 		if (fd < 0)
@@ -623,6 +875,8 @@ static void test_fs(int start)
 	inflateInit(&stream);
 	expand_fs(extract_dir, root);
 	inflateEnd(&stream);
+	if (pool.image)
+		stop_workers();
 	if (start_data != ~0UL) {
 		if (start_data < (sizeof(struct cramfs_super) + start))
 			errx(FSCK_EX_UNCORRECTED,
@@ -649,6 +903,7 @@ int main(int argc, char **argv)
 
 	static const struct option longopts[] = {
 		{"destination", required_argument, 0, 'x'},
+		{"threads", required_argument, 0, 'j'},
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -665,7 +920,7 @@ int main(int argc, char **argv)
 	outbuffer = xmalloc(page_size * 2);
 
 	/* command line options */
-	while ((c = getopt_long(argc, argv, "ayx:vVh", longopts, NULL)) != EOF)
+	while ((c = getopt_long(argc, argv, "ayj:x:vVh", longopts, NULL)) != EOF)
 		switch (c) {
 		case 'a':		/* ignore */
 		case 'y':
@@ -683,6 +938,16 @@ int main(int argc, char **argv)
 			break;
 #else
 			errx(FSCK_EX_USAGE, _("compiled without -x support"));
+#endif
+		case 'j':
+#ifdef INCLUDE_FS_TESTS
+			opt_threads = strtol_or_err(optarg,
+					_("invalid number of threads"));
+			if (opt_threads < 1)
+				errx(FSCK_EX_USAGE, _("invalid number of threads"));
+			break;
+#else
+			errx(FSCK_EX_USAGE, _("compiled without -j support"));
 #endif
 		case 'v':
 			opt_verbose++;
@@ -696,9 +961,16 @@ int main(int argc, char **argv)
 	filename = argv[optind];
 
 	test_super(&start, &length);
-	test_crc(start);
 #ifdef INCLUDE_FS_TESTS
+	/*
+	 * The workers test the CRC while the files are checked. The block
+	 * listing of -vv is only in order without them.
+	 */
+	if (opt_threads < 2 || opt_verbose > 1 || start_workers(start) != 0)
+		test_crc(start);
 	test_fs(start);
+#else
+	test_crc(start);
 #endif
 
 	if (opt_verbose)
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <zconf.h>
 #include <zlib.h>
 
@@ -51,12 +52,16 @@
 /* The kernel only supports PAD_SIZE of 0 and 512. */
 #define PAD_SIZE 512
 
+/* default cap for -j; every thread keeps 16 slots of 2*blksize buffers */
+#define DEFAULT_MAX_THREADS 4
+
 static int verbose = 0;
 
 static unsigned int blksize; /* settable via -b option */
 static long total_blocks = 0, total_nodes = 1; /* pre-count the root node */
 static int image_length = 0;
 static int cramfs_is_big_endian = 0; /* target is big endian */
+static long nthreads = 0; /* worker threads, settable via -j option */
 
 /*
  * If opt_holes is set, then mkcramfs can create explicit holes in the
@@ -120,13 +125,14 @@ usage(int status) {
 
 	fprintf(stream,
 		_("usage: %s [-h] [-v] [-b blksize] [-e edition] [-N endian] [-i file] "
-		  "[-n name] dirname outfile\n"
+		  "[-n name] [-j threads] dirname outfile\n"
 		  " -h         print this help\n"
 		  " -v         be verbose\n"
 		  " -E         make all warnings errors "
 		    "(non-zero exit status)\n"
 		  " -b blksize use this blocksize, must equal page size\n"
 		  " -e edition set edition number (part of fsid)\n"
+		  " -j threads number of worker threads (default: CPUs, at most 4)\n"
 		  " -N endian  set cramfs endianness (big|little|host), default host\n"
 		  " -i file    insert a file image into the filesystem "
 		    "(requires >= 2.4.0)\n"
@@ -237,38 +243,167 @@ identical_file(struct entry *e1, struct entry *e2){
  */
 #define MAX_INPUT_NAMELEN 255
 
-static int find_identical_file(struct entry *orig, struct entry *new, loff_t *fslen_ub)
+/*
+ * Duplicate elimination
+ *
+ * Every file is linked to the first identical file in the pre-order of the
+ * entry tree. The files are indexed by size in one pass, MD5 digests are
+ * computed (in parallel) only for the files that share their size with
+ * another file, and files with the same size and digest are compared byte
+ * by byte.
+ */
+struct dupnode {
+	struct entry *entry;
+	int digest;		/* size collision, the digest is needed */
+	struct dupnode *next;	/* in the same hash bucket */
+};
+
+struct dupindex {
+	struct dupnode *nodes;	/* in tree pre-order */
+	size_t nnodes;
+	struct dupnode **buckets;
+	size_t nbuckets;	/* power of 2 */
+
+	struct entry **todo;	/* files to compute digests for */
+	size_t ntodo;
+	size_t next;		/* the next digest for the workers */
+	pthread_mutex_t lock;
+};
+
+static void collect_doubles(struct dupindex *idx, struct entry *entry)
 {
-	if (orig == new)
-		return 1;
-	if (!orig)
-		return 0;
-	if (orig->size == new->size && orig->path) {
-		if (!orig->flags)
-			mdfile(orig);
-		if (!new->flags)
-			mdfile(new);
-
-		if ((orig->flags & CRAMFS_EFLAG_MD5) &&
-		    (new->flags & CRAMFS_EFLAG_MD5) &&
-		    !memcmp(orig->md5sum, new->md5sum, MD5LENGTH) &&
-		    identical_file(orig, new)) {
-			new->same = orig;
-			*fslen_ub -= new->size;
-			return 1;
+	struct entry *e;
+
+	for (e = entry; e; e = e->next) {
+		if (e->size && e->path) {
+			if (idx->nnodes % 1024 == 0)
+				idx->nodes = xrealloc(idx->nodes, (idx->nnodes + 1024)
+							* sizeof(struct dupnode));
+			memset(&idx->nodes[idx->nnodes], 0, sizeof(struct dupnode));
+			idx->nodes[idx->nnodes++].entry = e;
+		}
+		if (e->child)
+			collect_doubles(idx, e->child);
+	}
+}
+
+static size_t dup_hash(struct dupindex *idx, struct entry *e, int digest)
+{
+	uint32_t h = e->size * 0x9e3779b1U;
+
+	if (digest)
+		h ^= e->md5sum[0] | e->md5sum[1] << 8 |
+		     e->md5sum[2] << 16 | (uint32_t) e->md5sum[3] << 24;
+	return h & (idx->nbuckets - 1);
+}
+
+static void *mdfile_worker(void *data)
+{
+	struct dupindex *idx = data;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&idx->lock);
+		i = idx->next++;
+		pthread_mutex_unlock(&idx->lock);
+		if (i >= idx->ntodo)
+			break;
+		mdfile(idx->todo[i]);
+	}
+	return NULL;
+}
+
+static void mdfiles(struct dupindex *idx)
+{
+	pthread_t *threads = NULL;
+	long i, started = 0;
+
+	pthread_mutex_init(&idx->lock, NULL);
+
+	if (nthreads > 1 && idx->ntodo > 1) {
+		threads = xcalloc(nthreads, sizeof(pthread_t));
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&threads[i], NULL, mdfile_worker, idx) != 0)
+				break;
+			started++;
 		}
 	}
-	return find_identical_file(orig->child, new, fslen_ub) ||
-		   find_identical_file(orig->next, new, fslen_ub);
+	/* help the workers, or do it all if there are none */
+	mdfile_worker(idx);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&idx->lock);
 }
 
-static void eliminate_doubles(struct entry *root, struct entry *orig, loff_t *fslen_ub) {
-	if (orig) {
-		if (orig->size && orig->path)
-			find_identical_file(root,orig, fslen_ub);
-		eliminate_doubles(root,orig->child, fslen_ub);
-		eliminate_doubles(root,orig->next, fslen_ub);
+static void eliminate_doubles(struct entry *root, loff_t *fslen_ub)
+{
+	struct dupindex idx;
+	size_t i;
+
+	memset(&idx, 0, sizeof(idx));
+	collect_doubles(&idx, root);
+	if (idx.nnodes < 2)
+		goto done;
+
+	for (idx.nbuckets = 1024; idx.nbuckets < idx.nnodes; idx.nbuckets <<= 1)
+		;
+	idx.buckets = xcalloc(idx.nbuckets, sizeof(struct dupnode *));
+	idx.todo = xmalloc(idx.nnodes * sizeof(struct entry *));
+
+	/* index the sizes, only the first file of each size is kept */
+	for (i = 0; i < idx.nnodes; i++) {
+		struct dupnode *n = &idx.nodes[i], **p;
+
+		for (p = &idx.buckets[dup_hash(&idx, n->entry, 0)]; *p; p = &(*p)->next)
+			if ((*p)->entry->size == n->entry->size)
+				break;
+		if (!*p) {
+			*p = n;
+			continue;
+		}
+		if (!(*p)->digest) {
+			(*p)->digest = 1;
+			idx.todo[idx.ntodo++] = (*p)->entry;
+		}
+		n->digest = 1;
+		idx.todo[idx.ntodo++] = n->entry;
+	}
+	if (!idx.ntodo)
+		goto done;
+
+	mdfiles(&idx);
+
+	/* index the digests, link each file to the first identical one */
+	memset(idx.buckets, 0, idx.nbuckets * sizeof(struct dupnode *));
+	for (i = 0; i < idx.nnodes; i++) {
+		struct dupnode *n = &idx.nodes[i], **p;
+		struct entry *e = n->entry;
+
+		if (!n->digest || !(e->flags & CRAMFS_EFLAG_MD5))
+			continue;
+
+		n->next = NULL;
+		for (p = &idx.buckets[dup_hash(&idx, e, 1)]; *p; p = &(*p)->next) {
+			struct entry *orig = (*p)->entry;
+
+			if (orig->size == e->size &&
+			    !memcmp(orig->md5sum, e->md5sum, MD5LENGTH) &&
+			    identical_file(orig, e)) {
+				e->same = orig;
+				*fslen_ub -= e->size;
+				break;
+			}
+		}
+		if (!*p)
+			*p = n;
 	}
+done:
+	free(idx.nodes);
+	free(idx.buckets);
+	free(idx.todo);
 }
 
 /*
@@ -657,6 +792,281 @@ write_data(struct entry *entry, char *base, unsigned int offset) {
 	return offset;
 }
 
+/*
+ * Parallel compression
+ *
+ * The main thread walks the files in the same order as write_data(), maps
+ * them and queues their blocks to a ring of slots. Worker threads compress
+ * the blocks into the slots with exactly the same compress() calls as
+ * do_compress(), and the main thread copies the results to the image in
+ * order, so the offsets and block pointers -- and thus the whole image --
+ * are identical to the serial path.
+ */
+enum {
+	CBLOCK_FREE = 0,
+	CBLOCK_QUEUED,
+	CBLOCK_DONE
+};
+
+struct cblock {
+	Bytef *src;		/* uncompressed data, NULL for a hole */
+	uLong srclen;
+	Bytef *data;		/* compressed data, 2 * blksize */
+	uLongf len;
+	int state;		/* CBLOCK_* */
+};
+
+struct cfile {
+	struct entry *entry;
+	char *start;		/* mapped file, NULL if not mapped */
+	unsigned long blocks;
+	int mapped;		/* mapping attempted */
+};
+
+struct compressor {
+	pthread_mutex_t lock;
+	pthread_cond_t queued;	/* a block was queued or exiting */
+	pthread_cond_t done;	/* a block was compressed */
+	int exiting;
+
+	struct cblock *ring;
+	size_t nslots;
+	size_t head;		/* next block to be written to the image */
+	size_t next;		/* next block for the workers */
+	size_t tail;		/* next block to be queued */
+
+	struct cfile *files;	/* in write_data() order */
+	size_t nfiles;
+	size_t pfile;		/* the file being queued */
+	unsigned long pblock;	/* the next block of the file to queue */
+};
+
+static void *compress_worker(void *data)
+{
+	struct compressor *cm = data;
+
+	pthread_mutex_lock(&cm->lock);
+	for (;;) {
+		struct cblock *b;
+
+		while (!cm->exiting && cm->next == cm->tail)
+			pthread_cond_wait(&cm->queued, &cm->lock);
+		if (cm->next == cm->tail)
+			break;
+		b = &cm->ring[cm->next++ % cm->nslots];
+		pthread_mutex_unlock(&cm->lock);
+
+		b->len = 2 * blksize;
+		if (b->src)
+			compress(b->data, &b->len, b->src, b->srclen);
+
+		pthread_mutex_lock(&cm->lock);
+		b->state = CBLOCK_DONE;
+		pthread_cond_broadcast(&cm->done);
+	}
+	pthread_mutex_unlock(&cm->lock);
+	return NULL;
+}
+
+static void collect_files(struct compressor *cm, struct entry *entry)
+{
+	struct entry *e;
+
+	for (e = entry; e; e = e->next) {
+		if (e->path) {
+			if (!e->same && !e->size)
+				continue;
+			if (cm->nfiles % 256 == 0)
+				cm->files = xrealloc(cm->files, (cm->nfiles + 256)
+							* sizeof(struct cfile));
+			memset(&cm->files[cm->nfiles], 0, sizeof(struct cfile));
+			cm->files[cm->nfiles++].entry = e;
+		} else if (e->child)
+			collect_files(cm, e->child);
+	}
+}
+
+/* queue blocks until the ring is full or there is nothing more to do */
+static void queue_blocks(struct compressor *cm)
+{
+	int queued = 0;
+
+	while (cm->tail - cm->head < cm->nslots && cm->pfile < cm->nfiles) {
+		struct cfile *f = &cm->files[cm->pfile];
+		struct entry *e = f->entry;
+		struct cblock *b;
+		uLong input;
+
+		if (!f->mapped) {
+			f->mapped = 1;
+			if (!e->same) {
+				f->start = do_mmap(e->path, e->size, e->mode);
+				f->blocks = (e->size - 1) / blksize + 1;
+			}
+		}
+		if (!f->start || cm->pblock == f->blocks) {
+			cm->pfile++;
+			cm->pblock = 0;
+			continue;
+		}
+
+		input = e->size - cm->pblock * blksize;
+		if (input > blksize)
+			input = blksize;
+
+		b = &cm->ring[cm->tail % cm->nslots];
+		b->src = (Bytef *) f->start + cm->pblock * blksize;
+		b->srclen = input;
+		if (is_zero(b->src, input))
+			b->src = NULL;
+		cm->pblock++;
+
+		pthread_mutex_lock(&cm->lock);
+		b->state = CBLOCK_QUEUED;
+		cm->tail++;
+		pthread_mutex_unlock(&cm->lock);
+		queued = 1;
+	}
+
+	if (queued) {
+		pthread_mutex_lock(&cm->lock);
+		pthread_cond_broadcast(&cm->queued);
+		pthread_mutex_unlock(&cm->lock);
+	}
+}
+
+static struct cblock *wait_block(struct compressor *cm)
+{
+	struct cblock *b = &cm->ring[cm->head % cm->nslots];
+
+	pthread_mutex_lock(&cm->lock);
+	while (b->state != CBLOCK_DONE)
+		pthread_cond_wait(&cm->done, &cm->lock);
+	pthread_mutex_unlock(&cm->lock);
+	return b;
+}
+
+/* the same as do_compress(), but with the blocks compressed by workers */
+static unsigned int
+write_compressed(struct compressor *cm, struct cfile *f, char *base,
+		 unsigned int offset)
+{
+	struct entry *e = f->entry;
+	unsigned long original_offset = offset, new_size, curr, i;
+	long change;
+
+	curr = offset + 4 * f->blocks;
+	total_blocks += f->blocks;
+
+	for (i = 0; i < f->blocks; i++) {
+		struct cblock *b;
+
+		queue_blocks(cm);
+		b = wait_block(cm);
+
+		if (b->len > blksize*2) {
+			/* (I don't think this can happen with zlib.) */
+			printf(_("AIEEE: block \"compressed\" to > "
+				 "2*blocklength (%ld)\n"),
+			       b->len);
+			exit(MKFS_EX_ERROR);
+		}
+		if (b->src) {
+			memcpy(base + curr, b->data, b->len);
+			curr += b->len;
+		}
+		*(uint32_t *) (base + offset) = u32_toggle_endianness(cramfs_is_big_endian, curr);
+		offset += 4;
+
+		pthread_mutex_lock(&cm->lock);
+		b->state = CBLOCK_FREE;
+		cm->head++;
+		pthread_mutex_unlock(&cm->lock);
+	}
+
+	do_munmap(f->start, e->size, e->mode);
+
+	curr = (curr + 3) & ~3;
+	new_size = curr - original_offset;
+	change = new_size - e->size;
+	if (verbose)
+		printf(_("%6.2f%% (%+ld bytes)\t%s\n"),
+		       (change * 100) / (double) e->size, change, e->name);
+
+	return curr;
+}
+
+/*
+ * write_data() with a pool of compression threads. Returns the end of the
+ * data, or 0 if the threads cannot be started (nothing is written then).
+ */
+static unsigned int
+write_data_parallel(struct entry *root, char *base, unsigned int offset)
+{
+	struct compressor cm;
+	pthread_t *threads;
+	long i, started = 0;
+
+	memset(&cm, 0, sizeof(cm));
+	collect_files(&cm, root);
+	if (!cm.nfiles)
+		return offset;
+
+	pthread_mutex_init(&cm.lock, NULL);
+	pthread_cond_init(&cm.queued, NULL);
+	pthread_cond_init(&cm.done, NULL);
+
+	cm.nslots = nthreads * 16;
+	cm.ring = xcalloc(cm.nslots, sizeof(struct cblock));
+	for (i = 0; i < (long) cm.nslots; i++)
+		cm.ring[i].data = xmalloc(2 * blksize);
+
+	threads = xcalloc(nthreads, sizeof(pthread_t));
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, compress_worker, &cm) != 0)
+			break;
+		started++;
+	}
+
+	if (started) {
+		for (i = 0; i < (long) cm.nfiles; i++) {
+			struct cfile *f = &cm.files[i];
+			struct entry *e = f->entry;
+
+			if (e->same) {
+				set_data_offset(e, base, e->same->offset);
+				e->offset = e->same->offset;
+				continue;
+			}
+			set_data_offset(e, base, offset);
+			e->offset = offset;
+
+			/* make sure the file has been looked at */
+			queue_blocks(&cm);
+			if (f->start)
+				offset = write_compressed(&cm, f, base, offset);
+		}
+	}
+
+	pthread_mutex_lock(&cm.lock);
+	cm.exiting = 1;
+	pthread_cond_broadcast(&cm.queued);
+	pthread_mutex_unlock(&cm.lock);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < (long) cm.nslots; i++)
+		free(cm.ring[i].data);
+	free(cm.ring);
+	free(cm.files);
+	free(threads);
+	pthread_mutex_destroy(&cm.lock);
+	pthread_cond_destroy(&cm.queued);
+	pthread_cond_destroy(&cm.done);
+
+	return started ? offset : 0;
+}
+
 static unsigned int write_file(char *file, char *base, unsigned int offset)
 {
 	int fd;
@@ -725,7 +1135,7 @@ int main(int argc, char **argv)
 	atexit(close_stdout);
 
 	/* command line options */
-	while ((c = getopt(argc, argv, "hb:Ee:i:n:N:psVvz")) != EOF) {
+	while ((c = getopt(argc, argv, "hb:Ee:i:j:n:N:psVvz")) != EOF) {
 		switch (c) {
 		case 'h':
 			usage(MKFS_EX_OK);
@@ -756,6 +1166,11 @@ int main(int argc, char **argv)
 			image_length = st.st_size; /* may be padded later */
 			fslen_ub += (image_length + 3); /* 3 is for padding */
 			break;
+		case 'j':
+			nthreads = strtol_or_err(optarg, _("invalid number of threads"));
+			if (nthreads < 1)
+				errx(MKFS_EX_USAGE, _("invalid number of threads"));
+			break;
 		case 'n':
 			opt_name = optarg;
 			break;
@@ -798,8 +1213,16 @@ int main(int argc, char **argv)
 
 	root_entry->size = parse_directory(root_entry, dirname, &root_entry->child, &fslen_ub);
 
+	if (!nthreads) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads < 1)
+			nthreads = 1;
+		else if (nthreads > DEFAULT_MAX_THREADS)
+			nthreads = DEFAULT_MAX_THREADS;
+	}
+
 	/* find duplicate files */
-	eliminate_doubles(root_entry,root_entry, &fslen_ub);
+	eliminate_doubles(root_entry, &fslen_ub);
 
 	/* always allocate a multiple of blksize bytes because that's
 	   what we're going to write later on */
@@ -851,7 +1274,13 @@ int main(int argc, char **argv)
 	if (verbose)
 		printf(_("Directory data: %zd bytes\n"), offset);
 
-	offset = write_data(root_entry, rom_image, offset);
+	if (nthreads > 1) {
+		unsigned int end = write_data_parallel(root_entry, rom_image, offset);
+
+		/* fall back to the serial path if no thread could be started */
+		offset = end ? end : write_data(root_entry, rom_image, offset);
+	} else
+		offset = write_data(root_entry, rom_image, offset);
 
 	/* We always write a multiple of blksize bytes, so that
 	   losetup works. */
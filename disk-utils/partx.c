@@ -636,6 +636,7 @@ static int show_parts(blkid_partlist ls, int tt_flags, int lower, int upper)
 			goto done;
 		}
 	}
+	tt_set_stream(tt, TT_STREAM_LOOKAHEAD);
 
 	for (i = 0; i < nparts; i++) {
 		blkid_partition par = blkid_partlist_get_partition(ls, i);
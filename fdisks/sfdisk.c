@@ -41,6 +41,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 #include <limits.h>
 
 #include "c.h"
@@ -165,10 +166,25 @@ struct sector {
     char data[512];
 } *sectorhead;
 
+/*
+ * Read-ahead window used while walking chains of extended partitions;
+ * sectors missing in the chain above are copied from here if possible.
+ */
+#define READAHEAD_MAX	2048	/* sectors, 1 MiB */
+#define READAHEAD_EBRS	8	/* EBRs to cover by one read */
+
+static struct readahead {
+    unsigned long long start;	/* first sector in the window */
+    size_t count;		/* number of valid sectors */
+    char *data;			/* READAHEAD_MAX sectors */
+} ra;
+
 static void
 free_sectors(void) {
     struct sector *s;
 
+    ra.count = 0;
+
     while (sectorhead) {
 	s = sectorhead;
 	sectorhead = s->next;
@@ -184,6 +200,12 @@ get_sector(char *dev, int fd, unsigned long long sno) {
 	if (s->sectornumber == sno)
 	    return s;
 
+    if (ra.count && sno >= ra.start && sno < ra.start + ra.count) {
+	s = xmalloc(sizeof(struct sector));
+	memcpy(s->data, ra.data + (sno - ra.start) * 512, sizeof(s->data));
+	goto done;
+    }
+
     if (!sseek(dev, fd, sno))
 	return 0;
 
@@ -196,7 +218,7 @@ get_sector(char *dev, int fd, unsigned long long sno) {
 	free(s);
 	return 0;
     }
-
+done:
     s->next = sectorhead;
     sectorhead = s;
     s->sectornumber = sno;
@@ -205,6 +227,31 @@ get_sector(char *dev, int fd, unsigned long long sno) {
     return s;
 }
 
+/*
+ * Reads up to @count sectors starting at @sno into the read-ahead window
+ * with a single read. Nothing is cached on error.
+ */
+static void
+read_ahead(int fd, unsigned long long sno, size_t count) {
+    ssize_t n;
+
+    if (ra.count && sno >= ra.start && sno < ra.start + ra.count)
+	return;		/* already there */
+    if (count > READAHEAD_MAX)
+	count = READAHEAD_MAX;
+    if (count < 2)
+	return;
+    if (!ra.data)
+	ra.data = xmalloc(READAHEAD_MAX * 512);
+
+    ra.count = 0;
+    n = pread(fd, ra.data, count * 512, (off_t) sno << 9);
+    if (n >= 512) {
+	ra.start = sno;
+	ra.count = n / 512;
+    }
+}
+
 static int
 msdos_signature(struct sector *s) {
     unsigned char *data = (unsigned char *)s->data;
@@ -213,23 +260,64 @@ msdos_signature(struct sector *s) {
     return 0;
 }
 
+static int
+cmp_sectors(const void *a, const void *b) {
+    const struct sector *x = *(const struct sector **) a;
+    const struct sector *y = *(const struct sector **) b;
+
+    return x->sectornumber < y->sectornumber ? -1 :
+	   x->sectornumber > y->sectornumber ? 1 : 0;
+}
+
+/*
+ * Writes the modified sectors in ascending order, adjacent sectors are
+ * grouped into one write.
+ */
 static int
 write_sectors(char *dev, int fd) {
-    struct sector *s;
+    struct sector *s, **ary;
+    size_t i, j, n = 0;
+    char *buf = NULL;
+    int rc = 0;
 
     for (s = sectorhead; s; s = s->next)
-	if (s->to_be_written) {
-	    if (!sseek(dev, fd, s->sectornumber))
-		return 0;
-	    if (write(fd, s->data, sizeof(s->data)) != sizeof(s->data)) {
-		perror("write");
-		error(_("write error on %s - cannot write sector %lu\n"),
-		      dev, s->sectornumber);
-		return 0;
-	    }
-	    s->to_be_written = 0;
+	if (s->to_be_written)
+	    n++;
+    if (!n)
+	return 1;
+
+    ary = xmalloc(n * sizeof(struct sector *));
+    for (n = 0, s = sectorhead; s; s = s->next)
+	if (s->to_be_written)
+	    ary[n++] = s;
+    qsort(ary, n, sizeof(struct sector *), cmp_sectors);
+    buf = xmalloc(n * sizeof(s->data));
+
+    for (i = 0; i < n; i = j) {
+	size_t sz;
+	char *p = buf;
+
+	for (j = i; j < n; j++) {
+	    if (j > i && ary[j]->sectornumber != ary[j - 1]->sectornumber + 1)
+		break;
+	    memcpy(p, ary[j]->data, sizeof(ary[j]->data));
+	    p += sizeof(ary[j]->data);
 	}
-    return 1;
+	sz = p - buf;
+	if (pwrite(fd, buf, sz, (off_t) ary[i]->sectornumber << 9) != (ssize_t) sz) {
+	    perror("write");
+	    error(_("write error on %s - cannot write sector %lu\n"),
+		  dev, ary[i]->sectornumber);
+	    goto done;
+	}
+	while (i < j)
+	    ary[i++]->to_be_written = 0;
+    }
+    rc = 1;
+done:
+    free(buf);
+    free(ary);
+    return rc;
 }
 
 static void
@@ -1399,7 +1487,7 @@ static void
 extended_partition(char *dev, int fd, struct part_desc *ep, struct disk_desc *z) {
     char *cp;
     struct sector *s;
-    unsigned long long start, here, next;
+    unsigned long long start, here, next, prev = 0;
     int i, moretodo = 1;
     struct partition p;
     struct part_desc *partitions = &(z->partitions[0]);
@@ -1425,6 +1513,15 @@ extended_partition(char *dev, int fd, struct part_desc *ep, struct disk_desc *z)
     while (moretodo) {
 	moretodo = 0;
 
+	/* when the logical partitions are small, read the next few EBRs
+	 * with one request rather than one sector at a time */
+	if (prev && here > prev && here < ep->start + ep->size) {
+	    unsigned long long n = (here - prev) * READAHEAD_EBRS;
+
+	    read_ahead(fd, here, min(n, ep->start + ep->size - here));
+	}
+	prev = here;
+
 	if (!(s = get_sector(dev, fd, here)))
 	    break;
 
@@ -1721,6 +1818,9 @@ write_partitions(char *dev, int fd, struct disk_desc *z) {
 
 int eof, eob;
 
+/* partition layout input, standard input by default */
+static FILE *layout_file;
+
 struct dumpfld {
     int fldno;
     char *fldname;
@@ -1761,7 +1861,7 @@ read_stdin(char **fields, char *line, int fieldssize, int linesize) {
     fno = 0;
 
     /* read a line from stdin */
-    lp = fgets(line + 2, linesize - 2, stdin);
+    lp = fgets(line + 2, linesize - 2, layout_file ? layout_file : stdin);
     if (lp == NULL) {
 	eof = 1;
 	return RD_EOF;
@@ -2399,7 +2499,9 @@ static void usage(FILE * out)
 	fputs(_(" -N <number>               change only the partition with this <number>\n"
 		" -n                        do not actually write to disk\n"
 		" -O <file>                 save the sectors that will be overwritten to <file>\n"
-		" -I <file>                 restore sectors from <file>\n"), out);
+		" -I <file>                 restore sectors from <file>\n"
+		"     --parallel[=<jobs>]   write the same layout to all the devices,\n"
+		"                             at most <jobs> of them at once\n"), out);
 	fputs(_(" -V, --verify              check that the listed partitions are reasonable\n"
 		" -v, --version             display version information and exit\n"
 		" -h, --help                display this help text and exit\n"), out);
@@ -2463,7 +2565,8 @@ enum {
     OPT_NOT_INSIDE_OUTER,
     OPT_NESTED,
     OPT_CHAINED,
-    OPT_ONESECTOR
+    OPT_ONESECTOR,
+    OPT_PARALLEL
 };
 
 static const struct option long_opts[] = {
@@ -2496,6 +2599,7 @@ static const struct option long_opts[] = {
     { "no-reread",        no_argument, NULL, OPT_NO_REREAD },
     { "IBM",              no_argument, NULL, OPT_LEAVE_LAST },
     { "leave-last",       no_argument, NULL, OPT_LEAVE_LAST },
+    { "parallel",         optional_argument, NULL, OPT_PARALLEL },
 /* dangerous flags - not all completely implemented */
     { "in-order",         no_argument, NULL, OPT_IN_ORDER },
     { "not-in-order",     no_argument, NULL, OPT_NOT_IN_ORDER },
@@ -2545,6 +2649,7 @@ static void do_size(char *dev, int silent);
 static void do_geom(char *dev, int silent);
 static void do_pt_geom(char *dev, int silent);
 static void do_fdisk(char *dev);
+static void do_fdisk_parallel(char **devs, int ndevs, int jobs);
 static void do_reread(char *dev);
 static void do_change_id(char *dev, char *part, char *id);
 static void do_unhide(char **av, int ac, char *arg);
@@ -2567,6 +2672,8 @@ main(int argc, char **argv) {
     int fdisk = 0;
     char *activatearg = 0;
     char *unhidearg = 0;
+    int parallel = 0;
+    int jobs = 0;
 
     setlocale(LC_ALL, "");
     bindtextdomain(PACKAGE, LOCALEDIR);
@@ -2711,6 +2818,11 @@ main(int argc, char **argv) {
 	case OPT_LEAVE_LAST:
 	    leave_last = 1;
 	    break;
+	case OPT_PARALLEL:
+	    parallel = 1;
+	    if (optarg)
+		jobs = strtou32_or_err(optarg, _("invalid number of jobs"));
+	    break;
 	}
     }
 
@@ -2791,6 +2903,12 @@ main(int argc, char **argv) {
 	exit(exit_status);
     }
 
+    if (parallel) {
+	if (opt_reread || restore_sector_file || save_sector_file || one_only)
+	    errx(EXIT_FAILURE, _("--parallel cannot be combined with -R, -I, -O or -N"));
+	do_fdisk_parallel(argv + optind, argc - optind, jobs);
+    }
+
     if (optind != argc - 1)
 	errx(EXIT_FAILURE, _("can specify only one device (except with -l or -s)"));
     dev = argv[optind];
@@ -3229,3 +3347,219 @@ do_fdisk(char *dev) {
     sync();			/* superstition */
     exit(exit_status);
 }
+
+/*
+ * Parallel mode: one layout written to many disks
+ */
+enum {
+    PARALLEL_OK = 0,
+    PARALLEL_ERROR,		/* also the status of errx() in the worker */
+    PARALLEL_INUSE,
+    PARALLEL_LAYOUT,
+    PARALLEL_WRITE,
+    PARALLEL_REREAD
+};
+
+static const char *parallel_status[] = {
+    [PARALLEL_OK]     = N_("ok"),
+    [PARALLEL_ERROR]  = N_("failed"),
+    [PARALLEL_INUSE]  = N_("disk in use"),
+    [PARALLEL_LAYOUT] = N_("layout does not fit the disk"),
+    [PARALLEL_WRITE]  = N_("write failed"),
+    [PARALLEL_REREAD] = N_("written, re-read failed")
+};
+
+/* the validated layout all the disks are compared with */
+static struct disk_desc parallel_layout;
+
+static int
+same_layout(struct disk_desc *a, struct disk_desc *b) {
+    int pno;
+
+    if (a->partno != b->partno)
+	return 0;
+    for (pno = 0; pno < a->partno; pno++) {
+	struct part_desc *p = &(a->partitions[pno]), *q = &(b->partitions[pno]);
+
+	if (p->start != q->start || p->size != q->size
+	    || memcmp(&p->p, &q->p, sizeof(p->p)) != 0)
+	    return 0;
+    }
+    return 1;
+}
+
+static char *
+read_layout(size_t *sz) {
+    size_t len = 0, bufsz = 4096;
+    char *buf = xmalloc(bufsz);
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf + len, bufsz - len)) != 0) {
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    err(EXIT_FAILURE, _("read failed: %s"), _("standard input"));
+	}
+	len += n;
+	if (len == bufsz) {
+	    bufsz *= 2;
+	    buf = xrealloc(buf, bufsz);
+	}
+    }
+    if (!len)
+	errx(EXIT_FAILURE, _("no partition layout on standard input"));
+    *sz = len;
+    return buf;
+}
+
+static void
+open_layout(char *layout, size_t sz) {
+    if (layout_file)
+	fclose(layout_file);
+    layout_file = fmemopen(layout, sz, "r");
+    if (!layout_file)
+	err(EXIT_FAILURE, _("cannot read partition layout"));
+}
+
+/* runs in a child process, returns PARALLEL_* status */
+static int
+parallel_write_one(char *dev, char *layout, size_t sz) {
+    struct stat st;
+    int fd, blk, rc = PARALLEL_OK;
+
+    if (stat(dev, &st) < 0) {
+	warn("%s", dev);
+	return PARALLEL_ERROR;
+    }
+    blk = S_ISBLK(st.st_mode);
+    fd = my_open(dev, 1, 1);
+    if (fd < 0) {
+	warn(_("cannot open %s read-write"), dev);
+	return PARALLEL_ERROR;
+    }
+    if (blk && !no_reread && reread_ioctl(fd) && !force) {
+	close(fd);
+	return PARALLEL_INUSE;
+    }
+
+    free_sectors();
+    get_cylindersize(dev, fd, 1);
+    open_layout(layout, sz);
+    read_input(dev, 0, &newp);
+
+    if (!same_layout(&newp, &parallel_layout) && !force) {
+	warnx(_("%s: the layout differs from the validated one"), dev);
+	close(fd);
+	return PARALLEL_LAYOUT;
+    }
+
+    /* the sectors are grouped and fsync'ed once by write_partitions() */
+    if (!write_partitions(dev, fd, &newp))
+	rc = PARALLEL_WRITE;
+    else if (blk && reread_ioctl(fd))
+	rc = PARALLEL_REREAD;
+
+    if (close(fd) && rc == PARALLEL_OK) {
+	warn(_("Error closing %s\n"), dev);
+	rc = PARALLEL_WRITE;
+    }
+    return rc;
+}
+
+static void
+do_fdisk_parallel(char **devs, int ndevs, int jobs) {
+    pid_t *pids = xcalloc(ndevs, sizeof(pid_t));
+    int *status = xcalloc(ndevs, sizeof(int));
+    int i, next = 0, running = 0, nok = 0;
+    size_t sz;
+    char *layout;
+    int fd;
+
+    if (isatty(STDIN_FILENO))
+	errx(EXIT_FAILURE, _("--parallel expects the partition layout on standard input"));
+    layout = read_layout(&sz);
+
+    /* validate the layout once, against the first disk */
+    fd = my_open(devs[0], 0, 0);
+    free_sectors();
+    get_cylindersize(devs[0], fd, 0);
+    open_layout(layout, sz);
+    read_input(devs[0], 0, &newp);
+
+    printf(_("New situation:\n"));
+    out_partitions(devs[0], &newp);
+
+    if (!partitions_ok(fd, &newp) && !force)
+	errx(EXIT_FAILURE, _("I don't like these partitions - nothing changed.\n"
+			     "(If you really want this, use the --force option.)"));
+    close(fd);
+    free_sectors();
+    parallel_layout = newp;
+
+    if (no_write) {
+	warnx(_("-n flag was given: Nothing changed\n"));
+	exit(0);
+    }
+    if (jobs <= 0 || jobs > ndevs)
+	jobs = ndevs;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    while (next < ndevs || running) {
+	pid_t pid;
+	int st;
+
+	if (next < ndevs && running < jobs) {
+	    pid = fork();
+	    if (pid < 0)
+		err(EXIT_FAILURE, _("fork failed"));
+	    if (pid == 0) {
+		/* the per-disk listings would be interleaved */
+		int nul = open("/dev/null", O_WRONLY);
+
+		if (nul >= 0) {
+		    dup2(nul, STDOUT_FILENO);
+		    close(nul);
+		}
+		exit(parallel_write_one(devs[next], layout, sz));
+	    }
+	    pids[next++] = pid;
+	    running++;
+	    continue;
+	}
+
+	pid = wait(&st);
+	if (pid < 0) {
+	    if (errno == EINTR)
+		continue;
+	    err(EXIT_FAILURE, _("waitpid failed"));
+	}
+	for (i = 0; i < next; i++) {
+	    if (pids[i] != pid)
+		continue;
+	    if (WIFEXITED(st) && WEXITSTATUS(st) < (int) ARRAY_SIZE(parallel_status))
+		status[i] = WEXITSTATUS(st);
+	    else
+		status[i] = PARALLEL_ERROR;
+	    running--;
+	    break;
+	}
+    }
+
+    printf(_("\nResults:\n"));
+    for (i = 0; i < ndevs; i++) {
+	printf("%-20s %s\n", devs[i], _(parallel_status[status[i]]));
+	if (status[i] == PARALLEL_OK)
+	    nok++;
+	else
+	    exit_status = 1;
+    }
+    printf(_("%d of %d disks partitioned successfully\n"), nok, ndevs);
+
+    sync();			/* superstition */
+    free(layout);
+    free(pids);
+    free(status);
+    exit(exit_status);
+}
@@ -107,6 +107,41 @@ struct loopdev_cxt {
 
 #define UL_LOOPDEVCXT_EMPTY { .fd = -1, .sysfs = UL_SYSFSCXT_EMPTY }
 
+/*
+ * pool of free loop devices for mass setup (see loopdev_init_batch())
+ */
+struct loopdev_batch {
+	int		ctl;		/* open /dev/loop-control or -1 */
+	int		*minors;	/* pre-allocated free loop devices */
+	size_t		nminors;	/* number of items in *minors */
+	size_t		cur;		/* next not yet used item in *minors */
+};
+
+/*
+ * snapshot of all used loop devices (see loopdev_new_snapshot())
+ */
+struct loopdev_snapent {
+	char		*device;	/* device path (e.g. /dev/loop<N>) */
+	char		*filename;	/* backing file */
+	dev_t		devno;		/* loop device devno */
+	dev_t		backing_devno;	/* backing file st_dev */
+	ino_t		backing_ino;	/* backing file st_ino */
+	uint64_t	offset;
+	uint64_t	sizelimit;
+
+	unsigned int	has_inode:1;	/* backing_{devno,ino} are valid */
+};
+
+struct loopdev_snapshot {
+	struct loopdev_snapent	*ents;		/* sorted by devno */
+	size_t			nents;
+
+	struct loopdev_snapent	**by_inode;	/* sorted by backing_{devno,ino} */
+	size_t			ninodes;
+	struct loopdev_snapent	**by_name;	/* sorted by filename */
+	size_t			nnames;
+};
+
 /*
  * loopdev_cxt.flags
  */
@@ -135,9 +170,25 @@ extern int loopdev_is_used(const char *device, const char *filename,
 extern char *loopdev_find_by_backing_file(const char *filename,
 					  uint64_t offset, int flags);
 extern int loopcxt_find_unused(struct loopdev_cxt *lc);
+extern int loopdev_init_batch(struct loopdev_batch *bt, size_t nfree);
+extern void loopdev_deinit_batch(struct loopdev_batch *bt);
+extern int loopcxt_find_unused_batch(struct loopdev_cxt *lc,
+				     struct loopdev_batch *bt);
 extern int loopdev_delete(const char *device);
 extern int loopdev_count_by_backing_file(const char *filename, char **loopdev);
 
+extern struct loopdev_snapshot *loopdev_new_snapshot(void);
+extern void loopdev_free_snapshot(struct loopdev_snapshot *sn);
+extern struct loopdev_snapent *loopdev_snapshot_get_devno(
+				struct loopdev_snapshot *sn, dev_t devno);
+extern struct loopdev_snapent *loopdev_snapshot_find_by_backing_file(
+				struct loopdev_snapshot *sn,
+				struct stat *st, const char *filename,
+				uint64_t offset, int flags, size_t nth);
+extern int loopdev_snapent_is_used(struct loopdev_snapent *ent,
+				struct stat *st, const char *filename,
+				uint64_t offset, int flags);
+
 /*
  * Low-level
  */
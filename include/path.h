@@ -12,6 +12,10 @@ extern int path_write_str(const char *str, const char *path, ...)
 			 __attribute__ ((__format__ (__printf__, 2, 3)));
 extern int path_read_s32(const char *path, ...)
 			__attribute__ ((__format__ (__printf__, 1, 2)));
+extern int path_try_read_str(char *result, size_t len, const char *path, ...)
+			__attribute__ ((__format__ (__printf__, 3, 4)));
+extern int path_try_read_s32(int *result, const char *path, ...)
+			__attribute__ ((__format__ (__printf__, 2, 3)));
 extern uint64_t path_read_u64(const char *path, ...)
 			__attribute__ ((__format__ (__printf__, 1, 2)));
 
@@ -23,6 +27,8 @@ extern int path_exist(const char *path, ...)
 
 extern cpu_set_t *path_read_cpuset(int, const char *path, ...)
 			      __attribute__ ((__format__ (__printf__, 2, 3)));
+extern cpu_set_t *path_try_read_cpuset(int, const char *path, ...)
+			      __attribute__ ((__format__ (__printf__, 2, 3)));
 extern cpu_set_t *path_read_cpulist(int, const char *path, ...)
 			       __attribute__ ((__format__ (__printf__, 2, 3)));
 extern void path_set_prefix(const char *);
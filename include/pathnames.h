@@ -83,6 +83,7 @@
 #define _PATH_PROC_MOUNTINFO	"/proc/self/mountinfo"
 #define _PATH_PROC_LOCKS        "/proc/locks"
 #define _PATH_PROC_CDROMINFO	"/proc/sys/dev/cdrom/info"
+#define _PATH_PROC_BOOT_ID	"/proc/sys/kernel/random/boot_id"
 
 #define _PATH_PROC_ATTR_CURRENT	"/proc/self/attr/current"
 #define _PATH_PROC_ATTR_EXEC	"/proc/self/attr/exec"
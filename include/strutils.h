@@ -35,9 +35,16 @@ extern void strtotimeval_or_err(const char *str, struct timeval *tv,
 
 extern int isdigit_string(const char *str);
 
+#ifndef HAVE_MEMMEM
+extern void *memmem(const void *haystack, size_t haystacklen,
+		    const void *needle, size_t needlelen);
+#endif
 #ifndef HAVE_MEMPCPY
 extern void *mempcpy(void *restrict dest, const void *restrict src, size_t n);
 #endif
+#ifndef HAVE_MEMRCHR
+extern void *memrchr(const void *s, int c, size_t n);
+#endif
 #ifndef HAVE_STRNLEN
 extern size_t strnlen(const char *s, size_t maxlen);
 #endif
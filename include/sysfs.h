@@ -16,6 +16,8 @@
 #include <inttypes.h>
 #include <dirent.h>
 
+struct sysfs_attr;
+
 struct sysfs_cxt {
 	dev_t	devno;
 	int	dir_fd;		/* /sys/block/<name> */
@@ -27,7 +29,10 @@ struct sysfs_cxt {
 			scsi_target,
 			scsi_lun;
 
-	unsigned int	has_hctl : 1;
+	unsigned int	has_hctl : 1,
+			use_cache : 1;	/* cache attributes, see sysfs_enable_cache() */
+
+	struct sysfs_attr *attrs;	/* cached attributes */
 };
 
 #define UL_SYSFSCXT_EMPTY { 0, -1, NULL, NULL, 0, 0, 0, 0, 0 }
@@ -50,6 +55,10 @@ extern ssize_t sysfs_readlink(struct sysfs_cxt *cxt, const char *attr,
 	                   char *buf, size_t bufsiz);
 extern int sysfs_has_attribute(struct sysfs_cxt *cxt, const char *attr);
 
+extern void sysfs_enable_cache(struct sysfs_cxt *cxt);
+extern size_t sysfs_read_attrs(struct sysfs_cxt *cxt, const char * const *attrs,
+			       size_t nattrs);
+
 extern int sysfs_scanf(struct sysfs_cxt *cxt,  const char *attr,
 		       const char *fmt, ...)
 		        __attribute__ ((format (scanf, 3, 4)));
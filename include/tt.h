@@ -30,12 +30,19 @@ enum {
 	TT_FL_NOEXTREMES  = (1 << 9)    /* ignore extreme fields when count column width*/
 };
 
+/* default number of lines used to count columns width in streaming mode */
+#define TT_STREAM_LOOKAHEAD	1024
+
 struct tt {
 	size_t	ncols;		/* number of columns */
 	size_t	termwidth;	/* terminal width */
 	int	is_term;	/* is a tty? */
 	int	flags;
 	int	first_run;
+	int	stream;		/* print lines as soon as they are complete */
+
+	size_t	lookahead;	/* number of lines used to count columns width */
+	size_t	nlines;		/* number of not yet printed lines */
 
 	struct list_head	tb_columns;
 	struct list_head	tb_lines;
@@ -77,6 +84,7 @@ extern struct tt *tt_new_table(int flags);
 extern void tt_free_table(struct tt *tb);
 extern void tt_remove_lines(struct tt *tb);
 extern int tt_print_table(struct tt *tb);
+extern int tt_set_stream(struct tt *tb, size_t lookahead);
 
 extern struct tt_column *tt_define_column(struct tt *tb, const char *name,
 						double whint, int flags);
@@ -20,41 +20,124 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/syscall.h>
 
 #include "cpuset.h"
 #include "c.h"
 
-static inline int val_to_char(int v)
-{
-	if (v >= 0 && v < 10)
-		return '0' + v;
-	else if (v >= 10 && v < 16)
-		return ('a' - 10) + v;
-	else
-		return -1;
-}
+static const char hexdigits[] = "0123456789abcdef";
 
 static inline int char_to_val(int c)
 {
-	int cl;
-
-	cl = tolower(c);
 	if (c >= '0' && c <= '9')
 		return c - '0';
-	else if (cl >= 'a' && cl <= 'f')
-		return cl + (10 - 'a');
-	else
-		return -1;
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c + (10 - 'a');
+	return -1;
+}
+
+/*
+ * The routines below walk the set one __cpu_mask word at a time rather than
+ * bit by bit, which matters for the 4096+ CPU masks of big machines.
+ */
+#define CPUSET_WORDBITS		(8 * sizeof(__cpu_mask))
+#define CPUSET_WORDNIBBLES	(2 * sizeof(__cpu_mask))
+#define CPUSET_ALLONES		((__cpu_mask) ~0UL)
+
+static inline size_t word_ctz(__cpu_mask w)
+{
+#if __GNUC_PREREQ(3, 4)
+	return __builtin_ctzl(w);
+#else
+	size_t n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Returns the index of the first bit >= @from which is set (@value != 0) or
+ * cleared (@value == 0), or @nbits if there is no such bit.
+ */
+static size_t find_next_bit(const __cpu_mask *bits, size_t nbits,
+			    size_t from, int value)
+{
+	size_t idx = from / CPUSET_WORDBITS;
+	size_t nwords = nbits / CPUSET_WORDBITS;
+	__cpu_mask w;
+
+	if (from >= nbits)
+		return nbits;
+
+	w = value ? bits[idx] : ~bits[idx];
+	w &= CPUSET_ALLONES << (from % CPUSET_WORDBITS);
+
+	while (!w) {
+		if (++idx >= nwords)
+			return nbits;
+		w = value ? bits[idx] : ~bits[idx];
+	}
+	from = idx * CPUSET_WORDBITS + word_ctz(w);
+	return from < nbits ? from : nbits;
 }
 
-static const char *nexttoken(const char *q,  int sep)
+/*
+ * Sets CPUs @first..@last (inclusive), both have to fit into the set.
+ */
+static void set_range(__cpu_mask *bits, size_t first, size_t last)
 {
-	if (q)
-		q = strchr(q, sep);
-	if (q)
-		q++;
-	return q;
+	size_t i, fi = first / CPUSET_WORDBITS, li = last / CPUSET_WORDBITS;
+	__cpu_mask fm = CPUSET_ALLONES << (first % CPUSET_WORDBITS);
+	__cpu_mask lm = CPUSET_ALLONES >> (CPUSET_WORDBITS - 1 - last % CPUSET_WORDBITS);
+
+	if (fi == li) {
+		bits[fi] |= fm & lm;
+		return;
+	}
+	bits[fi] |= fm;
+	for (i = fi + 1; i < li; i++)
+		bits[i] = CPUSET_ALLONES;
+	bits[li] |= lm;
+}
+
+/*
+ * Writes decimal @num to the end of the buffer which ends at @end and
+ * returns pointer to the first digit.
+ */
+static char *format_cpu_number(char *end, size_t num)
+{
+	do {
+		*--end = '0' + num % 10;
+		num /= 10;
+	} while (num);
+	return end;
+}
+
+/*
+ * Parses an unsigned decimal number, leading blanks are ignored like
+ * sscanf("%u") does. Returns pointer after the number or NULL.
+ */
+static const char *parse_cpu_number(const char *p, unsigned int *res)
+{
+	unsigned long n = 0;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	if (!isdigit((unsigned char) *p))
+		return NULL;
+	for (; isdigit((unsigned char) *p); p++) {
+		n = n * 10 + (*p - '0');
+		if (n > UINT_MAX)
+			return NULL;
+	}
+	*res = n;
+	return p;
 }
 
 /*
@@ -63,10 +146,16 @@ static const char *nexttoken(const char *q,  int sep)
 int get_max_number_of_cpus(void)
 {
 #ifdef SYS_sched_getaffinity
+	static int maxcpus;
 	int n, cpus = 2048;
 	size_t setsize;
-	cpu_set_t *set = cpuset_alloc(cpus, &setsize, NULL);
+	cpu_set_t *set;
 
+	/* the kernel cpumask size does not change, probe it only once */
+	if (maxcpus > 0)
+		return maxcpus;
+
+	set = cpuset_alloc(cpus, &setsize, NULL);
 	if (!set)
 		return -1;	/* error */
 
@@ -85,6 +174,8 @@ int get_max_number_of_cpus(void)
 			continue;
 		}
 		cpuset_free(set);
+		if (n > 0)
+			maxcpus = n * 8;
 		return n * 8;
 	}
 #endif
@@ -152,39 +243,33 @@ int __cpuset_count_s(size_t setsize, const cpu_set_t *set)
 char *cpulist_create(char *str, size_t len,
 			cpu_set_t *set, size_t setsize)
 {
-	size_t i;
+	const __cpu_mask *bits = set->__bits;
+	size_t i = 0;
 	char *ptr = str;
 	int entry_made = 0;
 	size_t max = cpuset_nbits(setsize);
 
-	for (i = 0; i < max; i++) {
-		if (CPU_ISSET_S(i, setsize, set)) {
-			int rlen;
-			size_t j, run = 0;
-			entry_made = 1;
-			for (j = i + 1; j < max; j++) {
-				if (CPU_ISSET_S(j, setsize, set))
-					run++;
-				else
-					break;
-			}
-			if (!run)
-				rlen = snprintf(ptr, len, "%zd,", i);
-			else if (run == 1) {
-				rlen = snprintf(ptr, len, "%zd,%zd,", i, i + 1);
-				i++;
-			} else {
-				rlen = snprintf(ptr, len, "%zd-%zd,", i, i + run);
-				i += run;
-			}
-			if (rlen < 0 || (size_t) rlen + 1 > len)
-				return NULL;
-			ptr += rlen;
-			if (rlen > 0 && len > (size_t) rlen)
-				len -= rlen;
-			else
-				len = 0;
+	while ((i = find_next_bit(bits, max, i, 1)) < max) {
+		size_t end = find_next_bit(bits, max, i + 1, 0);
+		size_t run = end - i - 1;
+		char tmp[64], *p = tmp + sizeof(tmp);
+		size_t rlen;
+
+		entry_made = 1;
+		/* "i," or "i,i+1," or "i-i+run," formatted from the end */
+		*--p = ',';
+		p = format_cpu_number(p, i + run);
+		if (run) {
+			*--p = run == 1 ? ',' : '-';
+			p = format_cpu_number(p, i);
 		}
+		rlen = tmp + sizeof(tmp) - p;
+		if (rlen + 1 > len)
+			return NULL;
+		memcpy(ptr, p, rlen);
+		ptr += rlen;
+		len -= rlen;
+		i = end;
 	}
 	ptr -= entry_made;
 	*ptr = '\0';
@@ -198,31 +283,37 @@ char *cpulist_create(char *str, size_t len,
 char *cpumask_create(char *str, size_t len,
 			cpu_set_t *set, size_t setsize)
 {
+	const __cpu_mask *bits = set->__bits;
 	char *ptr = str;
 	char *ret = NULL;
-	int cpu;
+	ssize_t idx;
 
-	for (cpu = cpuset_nbits(setsize) - 4; cpu >= 0; cpu -= 4) {
-		char val = 0;
+	if (!len)
+		return NULL;
+	len--;		/* space for terminator */
 
-		if (len == (size_t) (ptr - str))
-			break;
+	for (idx = setsize / sizeof(__cpu_mask) - 1; idx >= 0; idx--) {
+		__cpu_mask w = bits[idx];
+		int shift;
 
-		if (CPU_ISSET_S(cpu, setsize, set))
-			val |= 1;
-		if (CPU_ISSET_S(cpu + 1, setsize, set))
-			val |= 2;
-		if (CPU_ISSET_S(cpu + 2, setsize, set))
-			val |= 4;
-		if (CPU_ISSET_S(cpu + 3, setsize, set))
-			val |= 8;
-
-		if (!ret && val)
-			ret = ptr;
-		*ptr++ = val_to_char(val);
+		if (!w && len - (ptr - str) >= CPUSET_WORDNIBBLES) {
+			memset(ptr, '0', CPUSET_WORDNIBBLES);
+			ptr += CPUSET_WORDNIBBLES;
+			continue;
+		}
+		for (shift = CPUSET_WORDBITS - 4; shift >= 0; shift -= 4) {
+			int val = (w >> shift) & 0xf;
+
+			if (len == (size_t) (ptr - str))
+				goto done;
+			if (!ret && val)
+				ret = ptr;
+			*ptr++ = hexdigits[val];
+		}
 	}
+done:
 	*ptr = '\0';
-	return ret ? ret : ptr - 1;
+	return ret ? ret : ptr > str ? ptr - 1 : ptr;
 }
 
 /*
@@ -230,9 +321,12 @@ char *cpumask_create(char *str, size_t len,
  */
 int cpumask_parse(const char *str, cpu_set_t *set, size_t setsize)
 {
-	int len = strlen(str);
+	__cpu_mask *bits = set->__bits;
+	size_t len = strlen(str);
 	const char *ptr = str + len - 1;
-	int cpu = 0;
+	size_t idx = 0, nwords = setsize / sizeof(__cpu_mask);
+	__cpu_mask w = 0;
+	unsigned int shift = 0;
 
 	/* skip 0x, it's all hex anyway */
 	if (len > 1 && !memcmp(str, "0x", 2L))
@@ -240,28 +334,31 @@ int cpumask_parse(const char *str, cpu_set_t *set, size_t setsize)
 
 	CPU_ZERO_S(setsize, set);
 
+	/* collect nibbles from the end of the string into words */
 	while (ptr >= str) {
-		char val;
+		int val;
 
 		/* cpu masks in /sys uses comma as a separator */
-		if (*ptr == ',')
-			ptr--;
+		if (*ptr == ',' && --ptr < str)
+			break;
 
 		val = char_to_val(*ptr);
-		if (val == (char) -1)
+		if (val < 0)
 			return -1;
-		if (val & 1)
-			CPU_SET_S(cpu, setsize, set);
-		if (val & 2)
-			CPU_SET_S(cpu + 1, setsize, set);
-		if (val & 4)
-			CPU_SET_S(cpu + 2, setsize, set);
-		if (val & 8)
-			CPU_SET_S(cpu + 3, setsize, set);
-		len--;
+		w |= (__cpu_mask) val << shift;
+		shift += 4;
+		if (shift == CPUSET_WORDBITS) {
+			/* bits beyond the set are silently ignored */
+			if (idx < nwords)
+				bits[idx] = w;
+			idx++;
+			w = 0;
+			shift = 0;
+		}
 		ptr--;
-		cpu += 4;
 	}
+	if (shift && idx < nwords)
+		bits[idx] = w;
 
 	return 0;
 }
@@ -276,73 +373,142 @@ int cpumask_parse(const char *str, cpu_set_t *set, size_t setsize)
  */
 int cpulist_parse(const char *str, cpu_set_t *set, size_t setsize, int fail)
 {
+	__cpu_mask *bits = set->__bits;
 	size_t max = cpuset_nbits(setsize);
-	const char *p, *q;
-	int r = 0;
+	const char *p = str;
 
-	q = str;
 	CPU_ZERO_S(setsize, set);
 
-	while (p = q, q = nexttoken(q, ','), p) {
+	do {
 		unsigned int a;	/* beginning of range */
 		unsigned int b;	/* end of range */
 		unsigned int s;	/* stride */
-		const char *c1, *c2;
-		char c;
+		size_t last;
 
-		if ((r = sscanf(p, "%u%c", &a, &c)) < 1)
+		p = parse_cpu_number(p, &a);
+		if (!p)
 			return 1;
 		b = a;
 		s = 1;
 
-		c1 = nexttoken(p, '-');
-		c2 = nexttoken(p, ',');
-		if (c1 != NULL && (c2 == NULL || c1 < c2)) {
-			if ((r = sscanf(c1, "%u%c", &b, &c)) < 1)
+		if (*p == '-') {
+			p = parse_cpu_number(p + 1, &b);
+			if (!p)
 				return 1;
-			c1 = nexttoken(c1, ':');
-			if (c1 != NULL && (c2 == NULL || c1 < c2)) {
-				if ((r = sscanf(c1, "%u%c", &s, &c)) < 1)
-					return 1;
-				if (s == 0)
+			if (*p == ':') {
+				p = parse_cpu_number(p + 1, &s);
+				if (!p || s == 0)
 					return 1;
 			}
 		}
-
+		if (*p && *p != ',')
+			return 1;
 		if (!(a <= b))
 			return 1;
-		while (a <= b) {
-			if (fail && (a >= max))
-				return 2;
-			CPU_SET_S(a, setsize, set);
-			a += s;
+
+		/* the last CPU of the range which is really set */
+		last = a + ((size_t) (b - a) / s) * s;
+		if (fail && last >= max)
+			return 2;
+		if (a >= max)
+			continue;
+		if (s == 1)
+			set_range(bits, a, last < max ? last : max - 1);
+		else {
+			size_t cpu;
+
+			for (cpu = a; cpu <= last && cpu < max; cpu += s)
+				CPU_SET_S(cpu, setsize, set);
 		}
-	}
+	} while (*p++ == ',');
 
-	if (r == 2)
-		return 1;
 	return 0;
 }
 
 #ifdef TEST_PROGRAM
 
 #include <getopt.h>
+#include <sys/time.h>
+
+static double bench_elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1e9
+		+ (now.tv_usec - start->tv_usec) * 1e3;
+}
+
+/*
+ * Times create/parse round trips of a sparse and of a dense set of @nbits.
+ */
+static void bench(cpu_set_t *set, size_t setsize, size_t nbits,
+		  char *buf, size_t buflen, int loops)
+{
+	const char *names[] = { "sparse", "dense" };
+	size_t i, pass;
+
+	for (pass = 0; pass < ARRAY_SIZE(names); pass++) {
+		struct timeval start;
+		char *mask, *list;
+		int l;
+
+		CPU_ZERO_S(setsize, set);
+		for (i = 0; i < nbits; i++) {
+			/* every 7th CPU, or everything except every 64th CPU */
+			if (pass == 0 ? i % 7 == 0 : i % 64 != 63)
+				CPU_SET_S(i, setsize, set);
+		}
+		mask = strdup(cpumask_create(buf, buflen, set, setsize));
+		list = strdup(cpulist_create(buf, buflen, set, setsize));
+		if (!mask || !list)
+			err(EXIT_FAILURE, "failed to allocate string");
+
+		gettimeofday(&start, NULL);
+		for (l = 0; l < loops; l++)
+			cpumask_create(buf, buflen, set, setsize);
+		printf("%-6s %5zu cpus: cpumask_create %10.0f ns\n", names[pass],
+				nbits, bench_elapsed(&start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (l = 0; l < loops; l++)
+			cpulist_create(buf, buflen, set, setsize);
+		printf("%-6s %5zu cpus: cpulist_create %10.0f ns\n", names[pass],
+				nbits, bench_elapsed(&start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (l = 0; l < loops; l++)
+			cpumask_parse(mask, set, setsize);
+		printf("%-6s %5zu cpus: cpumask_parse  %10.0f ns\n", names[pass],
+				nbits, bench_elapsed(&start) / loops);
+
+		gettimeofday(&start, NULL);
+		for (l = 0; l < loops; l++)
+			cpulist_parse(list, set, setsize, 0);
+		printf("%-6s %5zu cpus: cpulist_parse  %10.0f ns\n", names[pass],
+				nbits, bench_elapsed(&start) / loops);
+
+		free(mask);
+		free(list);
+	}
+}
 
 int main(int argc, char *argv[])
 {
 	cpu_set_t *set;
 	size_t setsize, buflen, nbits;
 	char *buf, *mask = NULL, *range = NULL;
-	int ncpus = 2048, rc, c;
+	int ncpus = 2048, loops = 0, rc, c;
 
 	static const struct option longopts[] = {
 	    { "ncpus", 1, 0, 'n' },
 	    { "mask",  1, 0, 'm' },
 	    { "range", 1, 0, 'r' },
+	    { "bench", 1, 0, 'b' },
 	    { NULL,    0, 0, 0 }
 	};
 
-	while ((c = getopt_long(argc, argv, "n:m:r:", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "n:m:r:b:", longopts, NULL)) != -1) {
 		switch(c) {
 		case 'n':
 			ncpus = atoi(optarg);
@@ -353,12 +519,15 @@ int main(int argc, char *argv[])
 		case 'r':
 			range = strdup(optarg);
 			break;
+		case 'b':
+			loops = atoi(optarg);
+			break;
 		default:
 			goto usage_err;
 		}
 	}
 
-	if (!mask && !range)
+	if (!mask && !range && loops <= 0)
 		goto usage_err;
 
 	set = cpuset_alloc(ncpus, &setsize, &nbits);
@@ -375,6 +544,11 @@ int main(int argc, char *argv[])
 	if (!buf)
 		err(EXIT_FAILURE, "failed to allocate cpu set buffer");
 
+	if (loops > 0) {
+		bench(set, setsize, nbits, buf, buflen, loops);
+		goto done;
+	}
+
 	if (mask)
 		rc = cpumask_parse(mask, set, setsize);
 	else
@@ -386,7 +560,7 @@ int main(int argc, char *argv[])
 	printf("%-15s = %15s ", mask ? : range,
 				cpumask_create(buf, buflen, set, setsize));
 	printf("[%s]\n", cpulist_create(buf, buflen, set, setsize));
-
+done:
 	free(buf);
 	free(range);
 	cpuset_free(set);
@@ -395,7 +569,7 @@ int main(int argc, char *argv[])
 
 usage_err:
 	fprintf(stderr,
-		"usage: %s [--ncpus <num>] --mask <mask> | --range <list>",
+		"usage: %s [--ncpus <num>] --mask <mask> | --range <list> | --bench <loops>\n",
 		program_invocation_short_name);
 	exit(EXIT_FAILURE);
 }
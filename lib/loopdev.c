@@ -1327,6 +1327,117 @@ int loopcxt_find_unused(struct loopdev_cxt *lc)
 }
 
 
+/*
+ * @bt: batch
+ * @nfree: number of requested free loop devices
+ *
+ * Initializes pool of free loop devices for mass setup. The /dev/loop-control
+ * is open for all the batch and up to @nfree unused devices are found by one
+ * /sys/block scan. The missing devices are not allocated in advance, see
+ * loopcxt_find_unused_batch(), so a failed setup does not leave an extra
+ * device behind.
+ *
+ * Note that the pool is not locked, the device could be stolen by another
+ * process; the LOOP_SET_FD ioctl returns EBUSY in this case and the caller
+ * should try the next device. See loopcxt_find_unused_batch().
+ *
+ * Returns: <0 on error, 0 on success
+ */
+int loopdev_init_batch(struct loopdev_batch *bt, size_t nfree)
+{
+	struct stat st;
+
+	if (!bt)
+		return -EINVAL;
+
+	memset(bt, 0, sizeof(*bt));
+	bt->ctl = open(_PATH_DEV_LOOPCTL, O_RDWR|O_CLOEXEC);
+
+	if (!nfree)
+		return 0;
+
+	bt->minors = calloc(nfree, sizeof(int));
+	if (!bt->minors)
+		return -ENOMEM;
+
+	/* A) unused loop devices, loop/backing_file is available since
+	 *    kernel 2.6.37 for used devices only
+	 */
+	if (stat(_PATH_SYS_BLOCK, &st) == 0 && S_ISDIR(st.st_mode) &&
+	    get_linux_version() >= KERNEL_VERSION(2,6,37)) {
+		DIR *dir = opendir(_PATH_SYS_BLOCK);
+		struct dirent *d;
+
+		while (dir && (d = readdir(dir))) {
+			char name[PATH_MAX];
+			int n;
+
+			if (bt->nminors == nfree)
+				break;
+			if (sscanf(d->d_name, "loop%d", &n) != 1)
+				continue;
+
+			snprintf(name, sizeof(name), "%s/loop/backing_file", d->d_name);
+			if (fstat_at(dirfd(dir), _PATH_SYS_BLOCK, name, &st, 0) == 0)
+				continue;	/* used */
+
+			bt->minors[bt->nminors++] = n;
+		}
+		if (dir)
+			closedir(dir);
+	}
+
+	qsort(bt->minors, bt->nminors, sizeof(int), cmpnum);
+	return 0;
+}
+
+void loopdev_deinit_batch(struct loopdev_batch *bt)
+{
+	if (!bt)
+		return;
+	if (bt->ctl >= 0)
+		close(bt->ctl);
+	free(bt->minors);
+	memset(bt, 0, sizeof(*bt));
+	bt->ctl = -1;
+}
+
+/*
+ * @lc: context
+ * @bt: batch initialized by loopdev_init_batch()
+ *
+ * The same as loopcxt_find_unused(), but the device is taken from the
+ * pool. If the pool is exhausted then the already open /dev/loop-control
+ * returns a free device (and allocates a new one if necessary).
+ *
+ * Returns: <0 on error, 0 on success
+ */
+int loopcxt_find_unused_batch(struct loopdev_cxt *lc, struct loopdev_batch *bt)
+{
+	char name[16];
+
+	if (!lc || !bt)
+		return -EINVAL;
+
+	if (bt->cur < bt->nminors) {
+		snprintf(name, sizeof(name), "loop%d", bt->minors[bt->cur++]);
+		DBG(lc, loopdev_debug("find_unused from batch pool: %s", name));
+		return loopcxt_set_device(lc, name);
+	}
+
+	if (bt->ctl >= 0) {
+		int n = ioctl(bt->ctl, LOOP_CTL_GET_FREE);
+
+		if (n >= 0) {
+			snprintf(name, sizeof(name), "loop%d", n);
+			DBG(lc, loopdev_debug("find_unused by batch loop-control: %s", name));
+			return loopcxt_set_device(lc, name);
+		}
+	}
+
+	return loopcxt_find_unused(lc);
+}
+
 
 /*
  * Return: TRUE/FALSE
@@ -1499,6 +1610,271 @@ int loopdev_count_by_backing_file(const char *filename, char **loopdev)
 	return count;
 }
 
+/*
+ * Loop devices snapshot
+ *
+ * The snapshot reads backing file, inode, offset and size limit of all used
+ * loop devices in one sweep. It's designed for callers which check many
+ * devices or backing files (e.g. libmount mnt_table_is_fs_mounted()) to
+ * avoid the iterate-and-compare approach for each check. Note that the
+ * snapshot is not updated, it's caller's business to read a new snapshot
+ * when necessary.
+ */
+static int cmp_snapent_devno(const void *a, const void *b)
+{
+	const struct loopdev_snapent *x = a, *y = b;
+
+	return x->devno < y->devno ? -1 : x->devno > y->devno ? 1 : 0;
+}
+
+static int cmp_snapent_inode(const void *a, const void *b)
+{
+	const struct loopdev_snapent *x = *(struct loopdev_snapent **) a,
+				     *y = *(struct loopdev_snapent **) b;
+
+	if (x->backing_devno != y->backing_devno)
+		return x->backing_devno < y->backing_devno ? -1 : 1;
+	if (x->backing_ino != y->backing_ino)
+		return x->backing_ino < y->backing_ino ? -1 : 1;
+	return 0;
+}
+
+static int cmp_snapent_name(const void *a, const void *b)
+{
+	const struct loopdev_snapent *x = *(struct loopdev_snapent **) a,
+				     *y = *(struct loopdev_snapent **) b;
+
+	return strcmp(x->filename, y->filename);
+}
+
+/*
+ * Returns newly allocated snapshot of all used loop devices or NULL in case
+ * of error.
+ */
+struct loopdev_snapshot *loopdev_new_snapshot(void)
+{
+	struct loopdev_snapshot *sn;
+	struct loopdev_cxt lc;
+	size_t i, alloc = 0;
+
+	sn = calloc(1, sizeof(*sn));
+	if (!sn)
+		return NULL;
+	if (loopcxt_init(&lc, 0))
+		goto err;
+	if (loopcxt_init_iterator(&lc, LOOPITER_FL_USED)) {
+		loopcxt_deinit(&lc);
+		goto err;
+	}
+
+	while (loopcxt_next(&lc) == 0) {
+		struct loopdev_snapent *ent;
+		struct sysfs_cxt *sysfs;
+		struct stat st;
+
+		if (sn->nents == alloc) {
+			struct loopdev_snapent *tmp;
+
+			alloc = alloc ? alloc * 2 : LOOPDEV_DEFAULT_NNODES;
+			tmp = realloc(sn->ents, alloc * sizeof(*tmp));
+			if (!tmp)
+				goto err_cxt;
+			sn->ents = tmp;
+		}
+		ent = &sn->ents[sn->nents];
+		memset(ent, 0, sizeof(*ent));
+
+		sysfs = loopcxt_get_sysfs(&lc);
+		if (sysfs)
+			ent->devno = sysfs->devno;
+		else if (stat(lc.device, &st) == 0)
+			ent->devno = st.st_rdev;
+
+		ent->device = loopcxt_strdup_device(&lc);
+		if (!ent->device)
+			goto err_cxt;
+		sn->nents++;
+
+		ent->filename = loopcxt_get_backing_file(&lc);
+		if (loopcxt_get_backing_inode(&lc, &ent->backing_ino) == 0 &&
+		    loopcxt_get_backing_devno(&lc, &ent->backing_devno) == 0)
+			ent->has_inode = 1;
+		loopcxt_get_offset(&lc, &ent->offset);
+		loopcxt_get_sizelimit(&lc, &ent->sizelimit);
+	}
+	loopcxt_deinit(&lc);
+
+	/* the index arrays point to the entries, don't reallocate sn->ents */
+	if (!sn->nents)
+		return sn;
+
+	qsort(sn->ents, sn->nents, sizeof(*sn->ents), cmp_snapent_devno);
+
+	sn->by_inode = calloc(sn->nents, sizeof(struct loopdev_snapent *));
+	sn->by_name = calloc(sn->nents, sizeof(struct loopdev_snapent *));
+	if (!sn->by_inode || !sn->by_name)
+		goto err;
+
+	for (i = 0; i < sn->nents; i++) {
+		struct loopdev_snapent *ent = &sn->ents[i];
+
+		if (ent->has_inode)
+			sn->by_inode[sn->ninodes++] = ent;
+		if (ent->filename)
+			sn->by_name[sn->nnames++] = ent;
+	}
+	qsort(sn->by_inode, sn->ninodes, sizeof(struct loopdev_snapent *),
+			cmp_snapent_inode);
+	qsort(sn->by_name, sn->nnames, sizeof(struct loopdev_snapent *),
+			cmp_snapent_name);
+	return sn;
+err_cxt:
+	loopcxt_deinit(&lc);
+err:
+	loopdev_free_snapshot(sn);
+	return NULL;
+}
+
+void loopdev_free_snapshot(struct loopdev_snapshot *sn)
+{
+	size_t i;
+
+	if (!sn)
+		return;
+
+	for (i = 0; i < sn->nents; i++) {
+		free(sn->ents[i].device);
+		free(sn->ents[i].filename);
+	}
+	free(sn->ents);
+	free(sn->by_inode);
+	free(sn->by_name);
+	free(sn);
+}
+
+/*
+ * Returns snapshot entry for loop device @devno or NULL if the device is not
+ * used (or does not exist).
+ */
+struct loopdev_snapent *loopdev_snapshot_get_devno(
+			struct loopdev_snapshot *sn, dev_t devno)
+{
+	struct loopdev_snapent key = { .devno = devno };
+
+	if (!sn || !sn->nents)
+		return NULL;
+
+	return bsearch(&key, sn->ents, sn->nents, sizeof(*sn->ents),
+			cmp_snapent_devno);
+}
+
+/*
+ * The same as loopcxt_is_used(), but for the snapshot entry.
+ */
+int loopdev_snapent_is_used(struct loopdev_snapent *ent,
+			    struct stat *st,
+			    const char *filename,
+			    uint64_t offset,
+			    int flags)
+{
+	if (!ent)
+		return 0;
+
+	if (st && ent->has_inode) {
+		if (ent->backing_ino != st->st_ino ||
+		    ent->backing_devno != st->st_dev)
+			return 0;
+	} else if (!filename || !ent->filename ||
+		   strcmp(ent->filename, filename) != 0)
+		return 0;
+
+	if (flags & LOOPDEV_FL_OFFSET)
+		return ent->offset == offset;
+	return 1;
+}
+
+/* returns index of the first item not less than @key */
+static size_t snapshot_lower_bound(struct loopdev_snapent **ary, size_t nents,
+			struct loopdev_snapent *key,
+			int (*cmp)(const void *, const void *))
+{
+	size_t lo = 0, hi = nents;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (cmp(&ary[mid], &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * @sn: snapshot
+ * @st: backing file stat or NULL
+ * @filename: backing file name
+ * @offset: offset
+ * @flags: LOOPDEV_FL_OFFSET if @offset should not be ignored
+ * @nth: number of the requested entry (0..N)
+ *
+ * Returns @nth loop device associated with the given backing file, the rules
+ * are the same as for loopcxt_is_used(). For example:
+ *
+ *	for (i = 0; (ent = loopdev_snapshot_find_by_backing_file(sn,
+ *				&st, name, 0, 0, i)); i++)
+ *		printf("%s\n", ent->device);
+ */
+struct loopdev_snapent *loopdev_snapshot_find_by_backing_file(
+			struct loopdev_snapshot *sn,
+			struct stat *st, const char *filename,
+			uint64_t offset, int flags, size_t nth)
+{
+	struct loopdev_snapent key, *pkey = &key, *ent;
+	size_t i;
+
+	if (!sn)
+		return NULL;
+
+	/* devno and inode number */
+	if (st) {
+		key.backing_devno = st->st_dev;
+		key.backing_ino = st->st_ino;
+
+		i = snapshot_lower_bound(sn->by_inode, sn->ninodes,
+					 pkey, cmp_snapent_inode);
+		for (; i < sn->ninodes; i++) {
+			ent = sn->by_inode[i];
+			if (cmp_snapent_inode(&ent, &pkey) != 0)
+				break;
+			if (loopdev_snapent_is_used(ent, st, filename, offset, flags)
+			    && nth-- == 0)
+				return ent;
+		}
+	}
+
+	/* poor man's solution, filename for devices without inode */
+	if (filename) {
+		key.filename = (char *) filename;
+
+		i = snapshot_lower_bound(sn->by_name, sn->nnames,
+					 pkey, cmp_snapent_name);
+		for (; i < sn->nnames; i++) {
+			ent = sn->by_name[i];
+			if (strcmp(ent->filename, filename) != 0)
+				break;
+			if (st && ent->has_inode)
+				continue;	/* already checked */
+			if (loopdev_snapent_is_used(ent, st, filename, offset, flags)
+			    && nth-- == 0)
+				return ent;
+		}
+	}
+
+	return NULL;
+}
+
 
 #ifdef TEST_PROGRAM_LOOPDEV
 #include <errno.h>
@@ -1561,6 +1937,35 @@ static void test_loop_scan(int flags, int debug)
 	loopcxt_deinit(&lc);
 }
 
+static void test_loop_snapshot(const char *filename)
+{
+	struct loopdev_snapshot *sn = loopdev_new_snapshot();
+	struct loopdev_snapent *ent;
+	struct stat st;
+	size_t i;
+
+	if (!sn)
+		err(EXIT_FAILURE, "failed to read loop devices snapshot");
+
+	if (!filename) {
+		for (i = 0; i < sn->nents; i++) {
+			ent = &sn->ents[i];
+			printf("\t%s: %s [offset=%ju, sizelimit=%ju]\n",
+					ent->device, ent->filename,
+					ent->offset, ent->sizelimit);
+		}
+	} else {
+		int hasst = stat(filename, &st) == 0;
+
+		for (i = 0; (ent = loopdev_snapshot_find_by_backing_file(sn,
+					hasst ? &st : NULL, filename,
+					0, 0, i)); i++)
+			printf("\t%s: %s\n", ent->device, ent->filename);
+	}
+
+	loopdev_free_snapshot(sn);
+}
+
 static int test_loop_setup(const char *filename, const char *device, int debug)
 {
 	struct loopdev_cxt lc;
@@ -1629,6 +2034,10 @@ int main(int argc, char *argv[])
 		printf("---all free devices---\n");
 		test_loop_scan(LOOPITER_FL_FREE, dbg);
 
+	} else if (argc >= 2 && strcmp(argv[1], "--snapshot") == 0) {
+		printf("---snapshot---\n");
+		test_loop_snapshot(argv[2]);
+
 	} else if (argc >= 3 && strcmp(argv[1], "--setup") == 0) {
 		test_loop_setup(argv[2], argv[3], dbg);
 
@@ -1645,6 +2054,7 @@ usage:
 			   "  %1$s --info <device>\n"
 			   "  %1$s --free\n"
 			   "  %1$s --used\n"
+			   "  %1$s --snapshot [<filename>]\n"
 			   "  %1$s --setup <filename> [<device>]\n"
 			   "  %1$s --delete\n",
 			   argv[0]);
@@ -73,6 +73,19 @@ path_vopen(int flags, const char *path, va_list ap)
 	return fd;
 }
 
+/*
+ * Returns NULL if the file does not exist, other errors are fatal.
+ */
+static FILE *
+path_try_vfopen(const char *path, va_list ap)
+{
+	FILE *f = path_vfopen("r" UL_CLOEXECSTR, 0, path, ap);
+
+	if (!f && errno != ENOENT)
+		err(EXIT_FAILURE, _("cannot open %s"), pathbuf);
+	return f;
+}
+
 FILE *
 path_fopen(const char *mode, int exit_on_error, const char *path, ...)
 {
@@ -105,6 +118,58 @@ path_read_str(char *result, size_t len, const char *path, ...)
 		result[len - 1] = '\0';
 }
 
+/*
+ * Returns -1 if the file does not exist, otherwise reads the string as
+ * path_read_str(). It's cheaper than path_exist() + path_read_str().
+ */
+int
+path_try_read_str(char *result, size_t len, const char *path, ...)
+{
+	FILE *fd;
+	va_list ap;
+
+	va_start(ap, path);
+	fd = path_try_vfopen(path, ap);
+	va_end(ap);
+
+	if (!fd)
+		return -1;
+	if (!fgets(result, len, fd))
+		err(EXIT_FAILURE, _("failed to read: %s"), pathbuf);
+	fclose(fd);
+
+	len = strlen(result);
+	if (len && result[len - 1] == '\n')
+		result[len - 1] = '\0';
+	return 0;
+}
+
+/*
+ * Returns -1 if the file does not exist, otherwise reads the number as
+ * path_read_s32().
+ */
+int
+path_try_read_s32(int *result, const char *path, ...)
+{
+	FILE *fd;
+	va_list ap;
+
+	va_start(ap, path);
+	fd = path_try_vfopen(path, ap);
+	va_end(ap);
+
+	if (!fd)
+		return -1;
+	if (fscanf(fd, "%d", result) != 1) {
+		if (ferror(fd))
+			err(EXIT_FAILURE, _("failed to read: %s"), pathbuf);
+		else
+			errx(EXIT_FAILURE, _("parse error: %s"), pathbuf);
+	}
+	fclose(fd);
+	return 0;
+}
+
 int
 path_read_s32(const char *path, ...)
 {
@@ -177,14 +242,18 @@ path_exist(const char *path, ...)
 #ifdef HAVE_CPU_SET_T
 
 static cpu_set_t *
-path_cpuparse(int maxcpus, int islist, const char *path, va_list ap)
+path_cpuparse(int maxcpus, int islist, int exit_on_error,
+	      const char *path, va_list ap)
 {
 	FILE *fd;
 	cpu_set_t *set;
 	size_t setsize, len = maxcpus * 7;
 	char buf[len];
 
-	fd = path_vfopen("r" UL_CLOEXECSTR, 1, path, ap);
+	fd = exit_on_error ? path_vfopen("r" UL_CLOEXECSTR, 1, path, ap) :
+			     path_try_vfopen(path, ap);
+	if (!fd)
+		return NULL;
 
 	if (!fgets(buf, len, fd))
 		err(EXIT_FAILURE, _("failed to read: %s"), pathbuf);
@@ -215,7 +284,23 @@ path_read_cpuset(int maxcpus, const char *path, ...)
 	cpu_set_t *set;
 
 	va_start(ap, path);
-	set = path_cpuparse(maxcpus, 0, path, ap);
+	set = path_cpuparse(maxcpus, 0, 1, path, ap);
+	va_end(ap);
+
+	return set;
+}
+
+/*
+ * Returns NULL if the file does not exist.
+ */
+cpu_set_t *
+path_try_read_cpuset(int maxcpus, const char *path, ...)
+{
+	va_list ap;
+	cpu_set_t *set;
+
+	va_start(ap, path);
+	set = path_cpuparse(maxcpus, 0, 0, path, ap);
 	va_end(ap);
 
 	return set;
@@ -228,7 +313,7 @@ path_read_cpulist(int maxcpus, const char *path, ...)
 	cpu_set_t *set;
 
 	va_start(ap, path);
-	set = path_cpuparse(maxcpus, 1, path, ap);
+	set = path_cpuparse(maxcpus, 1, 1, path, ap);
 	va_end(ap);
 
 	return set;
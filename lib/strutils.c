@@ -133,6 +133,25 @@ int isdigit_string(const char *str)
 }
 
 
+#ifndef HAVE_MEMMEM
+void *memmem(const void *haystack, size_t haystacklen,
+	     const void *needle, size_t needlelen)
+{
+	const char *p = haystack;
+
+	if (!needlelen)
+		return (void *) p;
+	while (haystacklen >= needlelen) {
+		if (*p == *(const char *) needle &&
+		    memcmp(p, needle, needlelen) == 0)
+			return (void *) p;
+		p++;
+		haystacklen--;
+	}
+	return NULL;
+}
+#endif
+
 #ifndef HAVE_MEMPCPY
 void *mempcpy(void *restrict dest, const void *restrict src, size_t n)
 {
@@ -140,6 +159,19 @@ void *mempcpy(void *restrict dest, const void *restrict src, size_t n)
 }
 #endif
 
+#ifndef HAVE_MEMRCHR
+void *memrchr(const void *s, int c, size_t n)
+{
+	const unsigned char *p = (const unsigned char *) s + n;
+
+	while (n--) {
+		if (*--p == (unsigned char) c)
+			return (void *) p;
+	}
+	return NULL;
+}
+#endif
+
 #ifndef HAVE_STRNLEN
 size_t strnlen(const char *s, size_t maxlen)
 {
@@ -10,6 +10,7 @@
 #include "at.h"
 #include "pathnames.h"
 #include "sysfs.h"
+#include "all-io.h"
 
 char *sysfs_devno_attribute_path(dev_t devno, char *buf,
 				 size_t bufsiz, const char *attr)
@@ -166,6 +167,33 @@ err:
 	return rc;
 }
 
+/*
+ * Cached attribute, @data is NULL if the attribute does not exist, or
+ * @parent is set if the attribute is read from the parent.
+ */
+struct sysfs_attr {
+	char		*name;
+	char		*data;
+	size_t		size;
+	unsigned int	parent : 1;
+	struct sysfs_attr *next;
+};
+
+static void sysfs_free_attrs(struct sysfs_cxt *cxt)
+{
+	struct sysfs_attr *a = cxt->attrs;
+
+	while (a) {
+		struct sysfs_attr *next = a->next;
+
+		free(a->name);
+		free(a->data);
+		free(a);
+		a = next;
+	}
+	cxt->attrs = NULL;
+}
+
 void sysfs_deinit(struct sysfs_cxt *cxt)
 {
 	if (!cxt)
@@ -174,6 +202,7 @@ void sysfs_deinit(struct sysfs_cxt *cxt)
 	if (cxt->dir_fd >= 0)
 	       close(cxt->dir_fd);
 	free(cxt->dir_path);
+	sysfs_free_attrs(cxt);
 
 	memset(cxt, 0, sizeof(*cxt));
 
@@ -261,11 +290,138 @@ DIR *sysfs_opendir(struct sysfs_cxt *cxt, const char *attr)
 }
 
 
-static FILE *sysfs_fopen(struct sysfs_cxt *cxt, const char *attr)
+/*
+ * Enables cache for attributes read by sysfs_scanf(), sysfs_strdup() and
+ * sysfs_read_*() functions. The attributes are read only once for lifetime
+ * of the @cxt (until sysfs_deinit()), so don't use the cache if the
+ * attributes are expected to be modified.
+ */
+void sysfs_enable_cache(struct sysfs_cxt *cxt)
+{
+	cxt->use_cache = 1;
+}
+
+static struct sysfs_attr *sysfs_get_cached(struct sysfs_cxt *cxt,
+					   const char *attr)
 {
-	int fd = sysfs_open(cxt, attr);
+	struct sysfs_attr *a;
 
-	return fd < 0 ? NULL : fdopen(fd, "r" UL_CLOEXECSTR);
+	for (a = cxt->attrs; a; a = a->next) {
+		if (strcmp(a->name, attr) == 0)
+			return a;
+	}
+	return NULL;
+}
+
+static struct sysfs_attr *sysfs_add_cached(struct sysfs_cxt *cxt,
+					   const char *attr,
+					   const char *data, size_t size)
+{
+	struct sysfs_attr *a = calloc(1, sizeof(*a));
+
+	if (!a)
+		return NULL;
+	a->name = strdup(attr);
+	if (data) {
+		a->data = malloc(size + 1);
+		if (a->data) {
+			memcpy(a->data, data, size);
+			a->data[size] = '\0';
+			a->size = size;
+		}
+	}
+	if (!a->name || (data && !a->data)) {
+		free(a->name);
+		free(a->data);
+		free(a);
+		return NULL;
+	}
+	a->next = cxt->attrs;
+	cxt->attrs = a;
+	return a;
+}
+
+/*
+ * Reads attribute content to @buf by read(2), the result is always
+ * terminated by zero. Returns number of read bytes or -1 on error.
+ */
+static ssize_t sysfs_read_raw(struct sysfs_cxt *cxt, const char *attr,
+			      char *buf, size_t bufsiz)
+{
+	struct sysfs_attr *a = NULL;
+	char data[BUFSIZ];	/* sysfs attributes are at most one page */
+	ssize_t sz = 0;
+	int fd;
+
+	if (!bufsiz)
+		return -1;
+
+	if (cxt->use_cache)
+		a = sysfs_get_cached(cxt, attr);
+	if (a && a->parent)
+		return sysfs_read_raw(cxt->parent, attr, buf, bufsiz);
+	if (a) {
+		if (!a->data)
+			return -1;
+		sz = a->size < bufsiz - 1 ? a->size : bufsiz - 1;
+		memcpy(buf, a->data, sz);
+		buf[sz] = '\0';
+		return sz;
+	}
+
+	fd = open_at(cxt->dir_fd, cxt->dir_path, attr, O_RDONLY|O_CLOEXEC);
+
+	if (fd == -1 && errno == ENOENT &&
+	    strncmp(attr, "queue/", 6) == 0 && cxt->parent) {
+		/* Exception for "queue/<attr>". These attributes are available
+		 * for parental devices only, use parent's cache
+		 */
+		if (cxt->use_cache && (a = sysfs_add_cached(cxt, attr, NULL, 0)))
+			a->parent = 1;
+		return sysfs_read_raw(cxt->parent, attr, buf, bufsiz);
+	}
+
+	if (fd >= 0) {
+		/* the whole attribute goes to the cache, not only @bufsiz */
+		if (cxt->use_cache)
+			sz = read_all(fd, data, sizeof(data) - 1);
+		else
+			sz = read_all(fd, buf, bufsiz - 1);
+		close(fd);
+	}
+	if (fd < 0 || sz < 0) {
+		if (cxt->use_cache && (fd >= 0 || errno == ENOENT))
+			sysfs_add_cached(cxt, attr, NULL, 0);
+		return -1;
+	}
+
+	if (cxt->use_cache) {
+		sysfs_add_cached(cxt, attr, data, sz);
+		if ((size_t) sz > bufsiz - 1)
+			sz = bufsiz - 1;
+		memcpy(buf, data, sz);
+	}
+	buf[sz] = '\0';
+	return sz;
+}
+
+/*
+ * Reads @attrs to the cache in one sweep (and enables the cache). Returns
+ * number of the available attributes.
+ */
+size_t sysfs_read_attrs(struct sysfs_cxt *cxt, const char * const *attrs,
+			size_t nattrs)
+{
+	char buf[BUFSIZ];
+	size_t i, n = 0;
+
+	sysfs_enable_cache(cxt);
+
+	for (i = 0; i < nattrs; i++) {
+		if (sysfs_read_raw(cxt, attrs[i], buf, sizeof(buf)) >= 0)
+			n++;
+	}
+	return n;
 }
 
 
@@ -366,62 +522,72 @@ dev_t sysfs_partno_to_devno(struct sysfs_cxt *cxt, int partno)
 
 int sysfs_scanf(struct sysfs_cxt *cxt,  const char *attr, const char *fmt, ...)
 {
-	FILE *f = sysfs_fopen(cxt, attr);
+	char buf[BUFSIZ];
 	va_list ap;
 	int rc;
 
-	if (!f)
+	if (sysfs_read_raw(cxt, attr, buf, sizeof(buf)) < 0)
 		return -EINVAL;
 	va_start(ap, fmt);
-	rc = vfscanf(f, fmt, ap);
+	rc = vsscanf(buf, fmt, ap);
 	va_end(ap);
 
-	fclose(f);
 	return rc;
 }
 
 
 int sysfs_read_s64(struct sysfs_cxt *cxt, const char *attr, int64_t *res)
 {
-	int64_t x = 0;
+	char buf[64], *end = NULL;
+	int64_t x;
 
-	if (sysfs_scanf(cxt, attr, "%"SCNd64, &x) == 1) {
-		if (res)
-			*res = x;
-		return 0;
-	}
-	return -1;
+	if (sysfs_read_raw(cxt, attr, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	errno = 0;
+	x = strtoimax(buf, &end, 10);
+	if (errno || !end || end == buf)
+		return -1;
+	if (res)
+		*res = x;
+	return 0;
 }
 
 int sysfs_read_u64(struct sysfs_cxt *cxt, const char *attr, uint64_t *res)
 {
-	uint64_t x = 0;
+	char buf[64], *end = NULL;
+	uint64_t x;
 
-	if (sysfs_scanf(cxt, attr, "%"SCNu64, &x) == 1) {
-		if (res)
-			*res = x;
-		return 0;
-	}
-	return -1;
+	if (sysfs_read_raw(cxt, attr, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	errno = 0;
+	x = strtoumax(buf, &end, 10);
+	if (errno || !end || end == buf)
+		return -1;
+	if (res)
+		*res = x;
+	return 0;
 }
 
 int sysfs_read_int(struct sysfs_cxt *cxt, const char *attr, int *res)
 {
-	int x = 0;
+	int64_t x;
 
-	if (sysfs_scanf(cxt, attr, "%d", &x) == 1) {
-		if (res)
-			*res = x;
-		return 0;
-	}
-	return -1;
+	if (sysfs_read_s64(cxt, attr, &x) != 0 || x < INT_MIN || x > INT_MAX)
+		return -1;
+	if (res)
+		*res = (int) x;
+	return 0;
 }
 
 char *sysfs_strdup(struct sysfs_cxt *cxt, const char *attr)
 {
 	char buf[1024];
-	return sysfs_scanf(cxt, attr, "%1023[^\n]", buf) == 1 ?
-						strdup(buf) : NULL;
+
+	if (sysfs_read_raw(cxt, attr, buf, sizeof(buf)) <= 0 || *buf == '\n')
+		return NULL;
+	return strndup(buf, strcspn(buf, "\n"));
 }
 
 int sysfs_count_dirents(struct sysfs_cxt *cxt, const char *attr)
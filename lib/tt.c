@@ -52,6 +52,13 @@ static const struct tt_symbols utf8_tt_symbols = {
 #define is_last_column(_tb, _cl) \
 		list_entry_is_last(&(_cl)->cl_columns, &(_tb)->tb_columns)
 
+#define is_parsable(_tb) \
+		(((_tb)->flags & TT_FL_RAW) || ((_tb)->flags & TT_FL_EXPORT))
+
+/* the tree output requires complete table, see tt_set_stream() */
+#define is_streaming(_tb) \
+		((_tb)->stream && !((_tb)->flags & TT_FL_TREE))
+
 /*
  * Counts number of cells in multibyte string. For all control and
  * non-printable chars is the result width enlarged to store \x?? hex
@@ -227,6 +234,7 @@ void tt_remove_lines(struct tt *tb)
 		free(ln->data);
 		free(ln);
 	}
+	tb->nlines = 0;
 }
 
 void tt_free_table(struct tt *tb)
@@ -245,6 +253,35 @@ void tt_free_table(struct tt *tb)
 	free(tb);
 }
 
+/*
+ * @tb: table
+ * @lookahead: number of lines used to count columns width
+ *
+ * Enables streaming output. The lines are printed (and deallocated) by
+ * tt_add_line() as soon as they are complete, it means when the next line is
+ * added. The rest of the lines is printed by tt_print_table() as usually.
+ *
+ * The raw and NAME=value output does not care about columns width, so all
+ * lines are printed immediately. For the aligned output the columns width is
+ * counted from the first @lookahead lines only, the output is the same as
+ * without streaming if the table is not longer than @lookahead lines.
+ *
+ * The tree output is never streamed, the ascii art depends on the lines added
+ * later. Note that the lines are not linked to the parental lines, the
+ * parental line may be already deallocated.
+ *
+ * Returns: 0 on success, -1 in case of error
+ */
+int tt_set_stream(struct tt *tb, size_t lookahead)
+{
+	if (!tb)
+		return -1;
+
+	tb->stream = TRUE;
+	tb->lookahead = lookahead ? lookahead : 1;
+	return 0;
+}
+
 
 /*
  * @tb: table
@@ -311,6 +348,17 @@ struct tt_line *tt_add_line(struct tt *tb, struct tt_line *parent)
 
 	if (!tb || !tb->ncols)
 		goto err;
+
+	/* all already added lines are complete, print them */
+	if (is_streaming(tb) && tb->nlines &&
+	    (!tb->first_run || is_parsable(tb) || tb->nlines >= tb->lookahead)) {
+		if (tt_print_table(tb))
+			goto err;
+		tt_remove_lines(tb);
+	}
+	if (is_streaming(tb))
+		parent = NULL;
+
 	ln = calloc(1, sizeof(*ln));
 	if (!ln)
 		goto err;
@@ -325,6 +373,7 @@ struct tt_line *tt_add_line(struct tt *tb, struct tt_line *parent)
 	INIT_LIST_HEAD(&ln->ln_branch);
 
 	list_add_tail(&ln->ln_lines, &tb->tb_lines);
+	tb->nlines++;
 
 	if (parent)
 		list_add_tail(&ln->ln_children, &parent->ln_branch);
@@ -743,8 +792,11 @@ static void print_data(struct tt *tb, struct tt_column *cl, char *data)
 	if (is_last_column(tb, cl) && len < width)
 		width = len;
 
-	/* truncate data */
-	if (len > width && (cl->flags & TT_FL_TRUNC)) {
+	/* truncate data -- the width is always large enough for non-terminal
+	 * output, except the streaming mode where the width is counted from
+	 * the first lines only. Don't truncate or wrap the data in this case.
+	 */
+	if (len > width && (cl->flags & TT_FL_TRUNC) && tb->is_term) {
 		if (data)
 			len = mbs_truncate(data, &width);
 		if (!data || len == (size_t) -1) {
@@ -766,7 +818,7 @@ static void print_data(struct tt *tb, struct tt_column *cl, char *data)
 		fputc(' ', stdout);		/* padding */
 
 	if (!is_last_column(tb, cl)) {
-		if (len > width && !(cl->flags & TT_FL_TRUNC)) {
+		if (len > width && !(cl->flags & TT_FL_TRUNC) && tb->is_term) {
 			fputc('\n', stdout);
 			for (i = 0; i <= (size_t) cl->seqnum; i++) {
 				struct tt_column *x = tt_get_column(tb, i);
@@ -899,8 +951,7 @@ int tt_print_table(struct tt *tb)
 	if (!line)
 		return -1;
 
-	if (tb->first_run &&
-	    !((tb->flags & TT_FL_RAW) || (tb->flags & TT_FL_EXPORT)))
+	if (tb->first_run && !is_parsable(tb))
 		recount_widths(tb, line, line_sz);
 
 	if (tb->flags & TT_FL_TREE)
@@ -923,22 +974,31 @@ int main(int argc, char *argv[])
 {
 	struct tt *tb;
 	struct tt_line *ln, *pr, *root;
-	int flags = 0, notree = 0, i;
+	int flags = 0, notree = 0, stream = 0, i;
+	size_t lookahead = 0;
 
-	if (argc == 2 && !strcmp(argv[1], "--help")) {
-		printf("%s [--ascii | --raw | --list]\n",
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--help")) {
+			printf("%s [--ascii | --raw | --export | --list] "
+			       "[--stream <lookahead>]\n",
 				program_invocation_short_name);
-		return EXIT_SUCCESS;
-	} else if (argc == 2 && !strcmp(argv[1], "--ascii")) {
-		flags |= TT_FL_ASCII;
-	} else if (argc == 2 && !strcmp(argv[1], "--raw")) {
-		flags |= TT_FL_RAW;
-		notree = 1;
-	} else if (argc == 2 && !strcmp(argv[1], "--export")) {
-		flags |= TT_FL_EXPORT;
-		notree = 1;
-	} else if (argc == 2 && !strcmp(argv[1], "--list"))
-		notree = 1;
+			return EXIT_SUCCESS;
+		} else if (!strcmp(argv[i], "--ascii")) {
+			flags |= TT_FL_ASCII;
+		} else if (!strcmp(argv[i], "--raw")) {
+			flags |= TT_FL_RAW;
+			notree = 1;
+		} else if (!strcmp(argv[i], "--export")) {
+			flags |= TT_FL_EXPORT;
+			notree = 1;
+		} else if (!strcmp(argv[i], "--list")) {
+			notree = 1;
+		} else if (!strcmp(argv[i], "--stream") && i + 1 < argc) {
+			stream = 1;
+			lookahead = strtoul(argv[++i], NULL, 10);
+		} else
+			errx(EXIT_FAILURE, "unknown option '%s'", argv[i]);
+	}
 
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
@@ -953,6 +1013,9 @@ int main(int argc, char *argv[])
 	tt_define_column(tb, "BAR", 0.3, 0);
 	tt_define_column(tb, "PATH", 0.3, 0);
 
+	if (stream && tt_set_stream(tb, lookahead))
+		err(EXIT_FAILURE, "failed to enable streaming");
+
 	for (i = 0; i < 2; i++) {
 		root = ln = tt_add_line(tb, NULL);
 		tt_line_set_data(ln, MYCOL_NAME, "AAA");
@@ -215,6 +215,10 @@ struct blkid_struct_probe
 
 	struct blkid_struct_probe *parent;	/* for clones */
 	struct blkid_struct_probe *disk_probe;	/* whole-disk probing */
+
+	struct blkid_struct_partlist *parts_cache; /* binary partitions result */
+	int			parts_cache_idx;	/* and its chain index */
+	int			parts_cache_flags;	/* and chain flags */
 };
 
 /* private flags library flags */
@@ -230,6 +234,7 @@ extern int blkid_probe_ignore_backup(blkid_probe pr);
 
 extern blkid_probe blkid_clone_probe(blkid_probe parent);
 extern blkid_probe blkid_probe_get_wholedisk_probe(blkid_probe pr);
+extern void blkid_partitions_free_cache(blkid_probe pr);
 
 /*
  * Evaluation methods (for blkid_eval_* API)
@@ -32,6 +32,43 @@ static const struct dos_subtypes {
 	{ BLKID_MINIX_PARTITION, &minix_pt_idinfo }
 };
 
+/*
+ * Read-ahead of the EBR chain; once the distance between two EBRs is known
+ * the next DOS_EBR_READAHEAD_EBRS of them are read by one request (but at most
+ * DOS_EBR_READAHEAD_MAX sectors) and the probe buffer is then reused.
+ * Returns the number of sectors read ahead.
+ */
+#define DOS_EBR_READAHEAD_EBRS	8
+#define DOS_EBR_READAHEAD_MAX	512	/* sectors */
+
+static uint32_t read_ahead_ebrs(blkid_probe pr, uint32_t cur, uint32_t prev,
+				uint64_t end)
+{
+	uint64_t n = (uint64_t) (cur - prev) * DOS_EBR_READAHEAD_EBRS;
+	uint64_t devsz = pr->size >> 9;
+	unsigned char *data;
+
+	if (end > devsz)
+		end = devsz;
+	if (cur >= end)
+		return 0;
+	if (n > end - cur)
+		n = end - cur;
+	if (n > DOS_EBR_READAHEAD_MAX)
+		n = DOS_EBR_READAHEAD_MAX;
+	if (n < 2)
+		return 0;
+
+	data = blkid_probe_get_buffer(pr, (blkid_loff_t) cur << 9,
+				      (blkid_loff_t) n << 9);
+	if (!data)
+		return 0;
+
+	DBG(LOWPROBE, blkid_debug("EBR read-ahead: %u +%u sectors",
+				  cur, (uint32_t) n));
+	return n;
+}
+
 static inline int is_extended(struct dos_partition *p)
 {
 	return (p->sys_type == BLKID_DOS_EXTENDED_PARTITION ||
@@ -44,6 +81,7 @@ static int parse_dos_extended(blkid_probe pr, blkid_parttable tab,
 {
 	blkid_partlist ls = blkid_probe_get_partlist(pr);
 	uint32_t cur_start = ex_start, cur_size = ex_size;
+	uint32_t prev_start = 0, ra_start = 0, ra_end = 0;
 	unsigned char *data;
 	int ct_nodata = 0;	/* count ext.partitions without data partitions */
 	int i;
@@ -54,6 +92,17 @@ static int parse_dos_extended(blkid_probe pr, blkid_parttable tab,
 
 		if (++ct_nodata > 100)
 			return 0;
+
+		/* logical partitions tend to be small and in order, read the
+		 * following EBRs together rather than one sector at a time */
+		if (prev_start && cur_start > prev_start &&
+		    (cur_start < ra_start || cur_start >= ra_end)) {
+			ra_start = cur_start;
+			ra_end = cur_start + read_ahead_ebrs(pr, cur_start,
+					prev_start, (uint64_t) ex_start + ex_size);
+		}
+		prev_start = cur_start;
+
 		data = blkid_probe_get_sector(pr, cur_start);
 		if (!data)
 			goto leave;	/* malformed partition? */
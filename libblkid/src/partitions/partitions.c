@@ -286,6 +286,9 @@ int blkid_probe_filter_partitions_type(blkid_probe pr, int flag, char *names[])
  * This function is independent on blkid_do_[safe,full]probe() and
  * blkid_probe_enable_partitions() calls.
  *
+ * The parsed result is kept in @pr together with the probing buffers, so
+ * repeated calls do not parse the partition table again.
+ *
  * WARNING: the returned object will be overwritten by the next
  *          blkid_probe_get_partitions() call for the same @pr. If you want to
  *          use more blkid_partlist objects in the same time you have to create
@@ -400,6 +403,124 @@ static void partitions_free_data(blkid_probe pr __attribute__((__unused__)),
 	free(ls);
 }
 
+/*
+ * Cache of the binary partition list in the probe.
+ *
+ * Every blkid_probe_get_partitions() call and every PART_ENTRY_* probe of a
+ * partition (by the whole-disk probe) parses the table again, although the
+ * data come from the probe buffers. The parsed list is kept in the probe
+ * with the same lifetime as the buffers (see blkid_probe_reset_buffer()), so
+ * it is never older than the data it has been parsed from. There is no
+ * state shared between probes.
+ */
+/* deep copy of @src to the reset list @dst */
+static int partlist_copy(blkid_partlist dst, blkid_partlist src)
+{
+	struct list_head *p;
+	int i;
+
+	if (src->nparts > dst->nparts_max) {
+		blkid_partition parts = realloc(dst->parts, src->nparts *
+					sizeof(struct blkid_struct_partition));
+		if (!parts)
+			return -1;
+		dst->parts = parts;
+		dst->nparts_max = src->nparts;
+	}
+	if (src->nparts)
+		memcpy(dst->parts, src->parts, src->nparts *
+				sizeof(struct blkid_struct_partition));
+	dst->nparts = src->nparts;
+	dst->next_partno = src->next_partno;
+
+	/* duplicate tables and redirect the pointers to the copies */
+	list_for_each(p, &src->l_tabs) {
+		blkid_parttable orig = list_entry(p,
+					struct blkid_struct_parttable, t_tabs);
+		blkid_parttable tab = malloc(sizeof(struct blkid_struct_parttable));
+
+		if (!tab)
+			return -1;
+		memcpy(tab, orig, sizeof(struct blkid_struct_parttable));
+		INIT_LIST_HEAD(&tab->t_tabs);
+		list_add_tail(&tab->t_tabs, &dst->l_tabs);
+
+		if (orig->parent)
+			tab->parent = dst->parts + (orig->parent - src->parts);
+		for (i = 0; i < dst->nparts; i++)
+			if (src->parts[i].tab == orig)
+				dst->parts[i].tab = tab;
+	}
+	return 0;
+}
+
+static int ptcache_usable(blkid_probe pr, struct blkid_chain *chn)
+{
+	size_t i;
+
+	/* clones share the parent's device; a wiped area means there
+	 * are previous results the probing functions have to check */
+	if (pr->parent || pr->wipe_size)
+		return 0;
+	if (chn->fltr) {
+		for (i = 0; i < ARRAY_SIZE(idinfos); i++)
+			if (blkid_bmp_get_item(chn->fltr, i))
+				return 0;
+	}
+	return 1;
+}
+
+void blkid_partitions_free_cache(blkid_probe pr)
+{
+	if (!pr->parts_cache)
+		return;
+	partitions_free_data(pr, pr->parts_cache);
+	pr->parts_cache = NULL;
+}
+
+/*
+ * Fills the chain data from the cache. Returns idinfos[] index of the
+ * partition table or -1 if not cached.
+ */
+static int ptcache_restore(blkid_probe pr, struct blkid_chain *chn)
+{
+	blkid_partlist ls = (blkid_partlist) chn->data;
+
+	if (!ls || !pr->parts_cache || pr->parts_cache_flags != chn->flags
+	    || !ptcache_usable(pr, chn))
+		return -1;
+
+	if (partlist_copy(ls, pr->parts_cache) != 0) {
+		reset_partlist(ls);
+		return -1;
+	}
+	DBG(LOWPROBE, blkid_debug("parts: cached %s table (%d partitions)",
+			idinfos[pr->parts_cache_idx]->name, ls->nparts));
+	return pr->parts_cache_idx;
+}
+
+static void ptcache_store(blkid_probe pr, struct blkid_chain *chn)
+{
+	blkid_partlist ls;
+
+	if (!chn->data || !ptcache_usable(pr, chn))
+		return;
+
+	ls = calloc(1, sizeof(struct blkid_struct_partlist));
+	if (!ls)
+		return;
+	reset_partlist(ls);
+	if (partlist_copy(ls, (blkid_partlist) chn->data) != 0) {
+		partitions_free_data(pr, ls);
+		return;
+	}
+
+	blkid_partitions_free_cache(pr);
+	pr->parts_cache = ls;
+	pr->parts_cache_idx = chn->idx;
+	pr->parts_cache_flags = chn->flags;
+}
+
 blkid_parttable blkid_partlist_new_parttable(blkid_partlist ls,
 				const char *type, blkid_loff_t offset)
 {
@@ -568,16 +689,28 @@ nothing:
  */
 static int partitions_probe(blkid_probe pr, struct blkid_chain *chn)
 {
-	int rc = 1;
+	int rc = 1, cacheable = 0;
 	size_t i;
 
 	if (!pr || chn->idx < -1)
 		return -1;
 	blkid_probe_chain_reset_vals(pr, chn);
 
-	if (chn->binary)
+	if (chn->binary) {
 		partitions_init_data(chn);
 
+		/* the binary result does not depend on anything else */
+		if (chn->idx < 0) {
+			int idx = ptcache_restore(pr, chn);
+
+			if (idx >= 0) {
+				chn->idx = idx;
+				return 0;
+			}
+			cacheable = 1;
+		}
+	}
+
 	if (!pr->wipe_size && (pr->prob_flags & BLKID_PROBE_FL_IGNORE_PT))
 		goto details_only;
 
@@ -615,7 +748,8 @@ static int partitions_probe(blkid_probe pr, struct blkid_chain *chn)
 	if (rc == 1) {
 		DBG(LOWPROBE, blkid_debug("<-- leaving probing loop (failed) [PARTS idx=%d]",
 			chn->idx));
-	}
+	} else if (cacheable)
+		ptcache_store(pr, chn);
 
 details_only:
 	/*
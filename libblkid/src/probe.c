@@ -591,7 +591,13 @@ static void blkid_probe_reset_buffer(blkid_probe pr)
 {
 	uint64_t read_ct = 0, len_ct = 0;
 
-	if (!pr || list_empty(&pr->buffers))
+	if (!pr)
+		return;
+
+	/* parsed from the buffers */
+	blkid_partitions_free_cache(pr);
+
+	if (list_empty(&pr->buffers))
 		return;
 
 	DBG(LOWPROBE, blkid_debug("reseting probing buffers pr=%p", pr));
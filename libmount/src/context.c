@@ -32,6 +32,7 @@
  */
 
 #include "mountP.h"
+#include "loopdev.h"
 
 #include <sys/wait.h>
 
@@ -140,12 +141,14 @@ int mnt_reset_context(struct libmnt_context *cxt)
 		mnt_free_fs(cxt->fs);
 
 	mnt_free_table(cxt->mtab);
+	loopdev_free_snapshot(cxt->loopdevs);
 
 	free(cxt->helper);
 	free(cxt->orig_user);
 
 	cxt->fs = NULL;
 	cxt->mtab = NULL;
+	cxt->loopdevs = NULL;
 	cxt->helper = NULL;
 	cxt->orig_user = NULL;
 	cxt->mountflags = 0;
@@ -2163,7 +2166,7 @@ int mnt_context_is_fs_mounted(struct libmnt_context *cxt,
 	if (rc)
 		return rc;
 
-	*mounted = mnt_table_is_fs_mounted(mtab, fs);
+	*mounted = __mnt_table_is_fs_mounted(mtab, fs, &cxt->loopdevs);
 	return 0;
 }
 
@@ -86,6 +86,8 @@ is_mounted_same_loopfile(struct libmnt_context *cxt,
 	struct libmnt_iter itr;
 	struct libmnt_fs *fs;
 	struct libmnt_cache *cache;
+	struct stat st;
+	int has_st;
 
 	assert(cxt);
 	assert(cxt->fs);
@@ -94,6 +96,8 @@ is_mounted_same_loopfile(struct libmnt_context *cxt,
 	if (!target || !backing_file || mnt_context_get_mtab(cxt, &tb))
 		return 0;
 
+	has_st = stat(backing_file, &st) == 0;
+
 	DBG(CXT, mnt_debug_h(cxt, "checking if %s mounted on %s",
 				backing_file, target));
 
@@ -114,14 +118,16 @@ is_mounted_same_loopfile(struct libmnt_context *cxt,
 			continue;
 
 		if (strncmp(src, "/dev/loop", 9) == 0) {
-			res = loopdev_is_used((char *) src, backing_file,
+			res = __mnt_is_loopdev_used(&cxt->loopdevs, src,
+					has_st ? &st : NULL, backing_file,
 					offset, LOOPDEV_FL_OFFSET);
 
 		} else if (opts && (cxt->user_mountflags & MNT_MS_LOOP) &&
 		    mnt_optstr_get_option(opts, "loop", &val, &len) == 0 && val) {
 
 			val = strndup(val, len);
-			res = loopdev_is_used((char *) val, backing_file,
+			res = __mnt_is_loopdev_used(&cxt->loopdevs, val,
+					has_st ? &st : NULL, backing_file,
 					offset, LOOPDEV_FL_OFFSET);
 			free(val);
 		}
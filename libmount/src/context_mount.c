@@ -1019,6 +1019,7 @@ int mnt_context_next_mount(struct libmnt_context *cxt,
 			   int *ignored)
 {
 	struct libmnt_table *fstab, *mtab;
+	struct loopdev_snapshot *loopdevs;
 	const char *o, *tgt;
 	int rc, mounted = 0;
 
@@ -1031,9 +1032,12 @@ int mnt_context_next_mount(struct libmnt_context *cxt,
 		return -EINVAL;
 
 	mtab = cxt->mtab;
+	loopdevs = cxt->loopdevs;
 	cxt->mtab = NULL;		/* do not reset mtab */
+	cxt->loopdevs = NULL;		/* ... and loop devices read for mtab */
 	mnt_reset_context(cxt);
 	cxt->mtab = mtab;
+	cxt->loopdevs = loopdevs;
 
 	rc = mnt_context_get_fstab(cxt, &fstab);
 	if (rc)
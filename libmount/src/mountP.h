@@ -276,6 +276,14 @@ struct libmnt_table {
 };
 
 extern struct libmnt_table *__mnt_new_table_from_file(const char *filename, int fmt);
+struct loopdev_snapshot;
+extern int __mnt_is_loopdev_used(struct loopdev_snapshot **sn,
+			const char *devname,
+			struct stat *st, const char *filename,
+			uint64_t offset, int flags);
+extern int __mnt_table_is_fs_mounted(struct libmnt_table *tb,
+			struct libmnt_fs *fstab_fs,
+			struct loopdev_snapshot **sn);
 
 /*
  * Tab file format
@@ -313,6 +321,7 @@ struct libmnt_context
 
 	struct libmnt_table *fstab;	/* fstab (or mtab for some remounts) entries */
 	struct libmnt_table *mtab;	/* mtab entries */
+	struct loopdev_snapshot *loopdevs;	/* used loop devices, valid as long as mtab */
 
 	int	(*table_errcb)(struct libmnt_table *tb,	/* callback for libmnt_table structs */
 			 const char *filename, int line);
@@ -944,6 +944,45 @@ static int is_mountinfo(struct libmnt_table *tb)
 	return 0;
 }
 
+/*
+ * Returns 1 if the loop device @devname is associated with the backing file
+ * @filename (or @st if not NULL), see loopcxt_is_used().
+ *
+ * All loop devices are read only once into *@sn, the first time it is
+ * needed. The caller keeps the snapshot as long as the mtab/mountinfo table
+ * it checks against (the context drops both in mnt_reset_context()), so
+ * "mount -a" reads the loop devices only once for all fstab entries.
+ */
+int __mnt_is_loopdev_used(struct loopdev_snapshot **sn,
+			  const char *devname,
+			  struct stat *st, const char *filename,
+			  uint64_t offset, int flags)
+{
+	struct stat dst;
+
+	assert(sn);
+
+	if (!devname)
+		return 0;
+	if (!*sn) {
+		*sn = loopdev_new_snapshot();
+		if (!*sn)
+			/* ENOMEM, use the old way */
+			return loopdev_is_used(devname, filename, offset, flags);
+		DBG(TAB, mnt_debug("loopdevs snapshot: %zu used devices",
+					(*sn)->nents));
+	}
+
+	/* the devno from mountinfo is st_dev of the filesystem, not the
+	 * loop device number (e.g. btrfs uses anonymous devices) */
+	if (stat(devname, &dst) != 0 || !S_ISBLK(dst.st_mode))
+		return 0;
+
+	return loopdev_snapent_is_used(
+			loopdev_snapshot_get_devno(*sn, dst.st_rdev),
+			st, filename, offset, flags);
+}
+
 /**
  * mnt_table_is_mounted:
  * @tb: /proc/self/mountinfo file
@@ -965,6 +1004,22 @@ static int is_mountinfo(struct libmnt_table *tb)
  * Returns: 0 or 1
  */
 int mnt_table_is_fs_mounted(struct libmnt_table *tb, struct libmnt_fs *fstab_fs)
+{
+	struct loopdev_snapshot *loopdevs = NULL;
+	int rc;
+
+	rc = __mnt_table_is_fs_mounted(tb, fstab_fs, &loopdevs);
+	loopdev_free_snapshot(loopdevs);
+	return rc;
+}
+
+/*
+ * The same as mnt_table_is_fs_mounted(), but used loop devices are read to
+ * (or reused from) *@sn, see __mnt_is_loopdev_used().
+ */
+int __mnt_table_is_fs_mounted(struct libmnt_table *tb,
+			      struct libmnt_fs *fstab_fs,
+			      struct loopdev_snapshot **sn)
 {
 	struct libmnt_iter itr;
 	struct libmnt_fs *fs;
@@ -972,7 +1027,8 @@ int mnt_table_is_fs_mounted(struct libmnt_table *tb, struct libmnt_fs *fstab_fs)
 	char *root = NULL;
 	const char *src = NULL, *tgt = NULL;
 	char *xtgt = NULL;
-	int rc = 0;
+	struct stat st;
+	int rc = 0, has_st = 0;
 
 	assert(tb);
 	assert(fstab_fs);
@@ -1035,7 +1091,12 @@ int mnt_table_is_fs_mounted(struct libmnt_table *tb, struct libmnt_fs *fstab_fs)
 			} else
 				flags = LOOPDEV_FL_OFFSET;
 
-			if (loopdev_is_used(mnt_fs_get_srcpath(fs), src, offset, flags))
+			if (!has_st)
+				has_st = stat(src, &st) == 0 ? 1 : -1;
+
+			if (__mnt_is_loopdev_used(sn,
+					mnt_fs_get_srcpath(fs),
+					has_st == 1 ? &st : NULL, src, offset, flags))
 				break;
 		}
 
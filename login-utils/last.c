@@ -48,6 +48,8 @@
 #include <time.h>
 #include <utmp.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -93,9 +95,23 @@ typedef struct ttytab {
 	long	logout;				/* log out time */
 	char	tty[LMAX + 1];			/* terminal name */
 	struct ttytab	*next;			/* linked list pointer */
+	struct ttytab	*hnext;			/* hash chain pointer */
 } TTY;
 TTY	*ttylist;				/* head of linked list */
 
+#define TTY_HASHSZ	1024			/* must be power of 2 */
+static TTY	*ttyhash[TTY_HASHSZ];		/* tty name -> TTY */
+
+/*
+ * ctime() is expensive and the output uses minutes only, so
+ * remember the last formatted minute.
+ */
+struct timecache {
+	time_t	minute;				/* time / 60 + 1, 0 = empty */
+	char	buf[26];			/* ctime_r() output */
+};
+static struct timecache	login_tc, logout_tc;
+
 static long	currentout,			/* current logout value */
 		maxrec;				/* records to display */
 static char	*file = _PATH_WTMP;		/* wtmp file */
@@ -103,25 +119,41 @@ static char	*file = _PATH_WTMP;		/* wtmp file */
 static int	doyear = 0;			/* output year in dates */
 static int	dolong = 0;			/* print also ip-addr */
 
+static time_t	since = 0,			/* --since, 0 = unlimited */
+		until = 0;			/* --until, 0 = unlimited */
+
 static void wtmp(void);
 static void addarg(int, char *);
 static void hostconv(char *);
 static void onintr(int);
 static int want(struct utmp *, int);
 TTY *addtty(char *);
+TTY *findtty(char *);
 static char *ttyconv(char *);
+static time_t parse_time(const char *);
 
 int
 main(int argc, char **argv) {
 	int	ch;
 
+	enum {
+		OPT_SINCE = CHAR_MAX + 1,
+		OPT_UNTIL
+	};
+	static const struct option longopts[] = {
+		{ "since", required_argument, 0, OPT_SINCE },
+		{ "until", required_argument, 0, OPT_UNTIL },
+		{ NULL, 0, 0, 0 }
+	};
+
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 	atexit(close_stdout);
 
-	while ((ch = getopt(argc, argv, "0123456789yli:f:h:t:")) != -1)
-		switch((char)ch) {
+	while ((ch = getopt_long(argc, argv, "0123456789yli:f:h:t:",
+				 longopts, NULL)) != -1)
+		switch(ch) {
 		case '0': case '1': case '2': case '3': case '4':
 		case '5': case '6': case '7': case '8': case '9':
 			/*
@@ -150,9 +182,16 @@ main(int argc, char **argv) {
 		case 'i':
 			addarg(INET_TYPE, optarg);
 			break;
+		case OPT_SINCE:
+			since = parse_time(optarg);
+			break;
+		case OPT_UNTIL:
+			until = parse_time(optarg);
+			break;
 		case '?':
 		default:
-			fputs(_("usage: last [-#] [-f file] [-t tty] [-h hostname] [user ...]\n"), stderr);
+			fputs(_("usage: last [-#] [-f file] [-t tty] [-h hostname] "
+				"[--since time] [--until time] [user ...]\n"), stderr);
 			exit(EXIT_FAILURE);
 		}
 	for (argv += optind; *argv; ++argv) {
@@ -174,6 +213,57 @@ static char *utmp_ctime(struct utmp *u)
 	return ctime(&t);
 }
 
+/*
+ * cached_ctime --
+ *	ctime() with the result reused for all times within one minute
+ */
+static char *
+cached_ctime(struct timecache *tc, time_t t) {
+	time_t minute = t / 60 + 1;
+
+	if (tc->minute != minute) {
+		if (!ctime_r(&t, tc->buf))
+			return ctime(&t);
+		tc->minute = minute;
+	}
+	return tc->buf;
+}
+
+/*
+ * fmt_delta --
+ *	format session duration as hh:mm
+ */
+static char *
+fmt_delta(long delta) {
+	static char buf[16];
+	long secs = delta % SECDAY;
+
+	if (secs < 0)
+		secs += SECDAY;
+	snprintf(buf, sizeof(buf), "%02ld:%02ld", secs / 3600, secs % 3600 / 60);
+	return buf;
+}
+
+/*
+ * first_after --
+ *	binary search for the first record newer than or equal to @t, the
+ *	wtmp records are expected in time order
+ */
+static int
+first_after(struct utmp *utl, int nrecs, time_t t) {
+	int lo = 0, hi = nrecs;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if ((time_t) utl[mid].ut_time < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 /*
  * print_partial_line --
  *	print the first part of each output line according to specified format
@@ -182,7 +272,7 @@ static void
 print_partial_line(struct utmp *bp) {
     char *ct;
 
-    ct = utmp_ctime(bp);
+    ct = cached_ctime(&login_tc, (time_t) bp->ut_time);
     printf("%-*.*s  %-*.*s ", P_NMAX, P_NMAX, bp->ut_name,
 	   P_LMAX, P_LMAX, bp->ut_line);
 
@@ -215,12 +305,12 @@ wtmp(void) {
 	register TTY	*T;			/* tty list entry */
 	long	delta;				/* time difference */
 	char *crmsg = NULL;
-	char *ct = NULL;
 	int fd;
 	struct utmp *utl;
 	struct stat st;
 	int utl_len;
 	int listnr = 0;
+	int first = 0;
 	int i;
 
 	utmpname(file);
@@ -248,15 +338,21 @@ wtmp(void) {
 	utl_len = st.st_size;
 	utl = mmap(NULL, utl_len, PROT_READ|PROT_WRITE,
 		   MAP_PRIVATE|MAP_FILE, fd, 0);
-	if (utl == NULL)
+	if (utl == MAP_FAILED)
 		err(EXIT_FAILURE, _("%s: mmap failed"), file);
 
 	listnr = utl_len/sizeof(struct utmp);
 
-	if(listnr) 
-		ct = utmp_ctime(&utl[0]);
+	/*
+	 * Records out of the --since/--until window are ignored, so don't
+	 * walk them at all.
+	 */
+	if (listnr && since)
+		first = first_after(utl, listnr, since);
+	if (listnr && until)
+		listnr = max(first_after(utl, listnr, until + 1), first);
 
-	for(i = listnr - 1; i >= 0; i--) {
+	for(i = listnr - 1; i >= first; i--) {
 		bp = utl+i;
 		/*
 		 * if the terminal line is '~', the machine stopped.
@@ -282,7 +378,6 @@ wtmp(void) {
 		    if (!bp->ut_name[0])
 			(void)strcpy(bp->ut_name, "reboot");
 		    if (want(bp, NO)) {
-			ct = utmp_ctime(bp);
 			if(bp->ut_type != LOGIN_PROCESS) {
 			    print_partial_line(bp);
 			    putchar('\n');
@@ -293,15 +388,9 @@ wtmp(void) {
 		    continue;
 		}
 		/* find associated tty */
-		for (T = ttylist;; T = T->next) {
-		    if (!T) {
-			/* add new one */
-			T = addtty(bp->ut_line);
-			break;
-		    }
-		    if (!strncmp(T->tty, bp->ut_line, LMAX))
-			break;
-		}
+		T = findtty(bp->ut_line);
+		if (!T)
+		    T = addtty(bp->ut_line);
 		if (bp->ut_name[0] && bp->ut_type != LOGIN_PROCESS
 		    && bp->ut_type != DEAD_PROCESS
 		    && want(bp, YES)) {
@@ -316,12 +405,12 @@ wtmp(void) {
 			    printf("- %s", crmsg);
 			}
 			else
-			    printf("- %5.5s", ctime(&T->logout)+11);
+			    printf("- %5.5s", cached_ctime(&logout_tc, T->logout)+11);
 			delta = T->logout - bp->ut_time;
 			if (delta < SECDAY)
-			    printf("  (%5.5s)\n", asctime(gmtime(&delta))+11);
+			    printf("  (%s)\n", fmt_delta(delta));
 			else
-			    printf(" (%ld+%5.5s)\n", delta / SECDAY, asctime(gmtime(&delta))+11);
+			    printf(" (%ld+%s)\n", delta / SECDAY, fmt_delta(delta));
 		    }
 		    if (maxrec != -1 && !--maxrec)
 			return;
@@ -329,9 +418,11 @@ wtmp(void) {
 		T->logout = bp->ut_time;
 		utmpbuf.ut_time = bp->ut_time;
 	}
+	if (utl_len >= (int) sizeof(struct utmp))
+		printf(_("\nwtmp begins %s"),	/* ctime() already ends in \n */
+		       utmp_ctime(&utl[0]));
 	munmap(utl,utl_len);
 	close(fd);
-	if(ct) printf(_("\nwtmp begins %s"), ct); 	/* ct already ends in \n */
 }
 
 /*
@@ -399,17 +490,114 @@ addarg(int type, char *arg) {
  * addtty --
  *	add an entry to a linked list of ttys
  */
+static unsigned int
+hashtty(const char *ttyname) {
+	unsigned int h = 0;
+	int i;
+
+	for (i = 0; i < LMAX && ttyname[i]; i++)
+		h = h * 31 + (unsigned char) ttyname[i];
+	return h & (TTY_HASHSZ - 1);
+}
+
 TTY *
 addtty(char *ttyname) {
 	register TTY	*cur;
+	unsigned int	h = hashtty(ttyname);
 
-	cur = xmalloc(sizeof(TTY));
+	cur = xcalloc(1, sizeof(TTY));
 	cur->next = ttylist;
+	cur->hnext = ttyhash[h];
 	cur->logout = currentout;
 	memcpy(cur->tty, ttyname, LMAX);
+	ttyhash[h] = cur;
 	return(ttylist = cur);
 }
 
+/*
+ * findtty --
+ *	lookup the tty in the hash table
+ */
+TTY *
+findtty(char *ttyname) {
+	register TTY	*cur;
+
+	for (cur = ttyhash[hashtty(ttyname)]; cur; cur = cur->hnext)
+		if (!strncmp(cur->tty, ttyname, LMAX))
+			return cur;
+	return NULL;
+}
+
+/*
+ * parse_time --
+ *	convert --since/--until argument to time_t; accepts "now", "today",
+ *	"yesterday", "-<number>[smhd]" and "YYYY-MM-DD [hh:mm[:ss]]" or
+ *	"hh:mm[:ss]" in local time
+ */
+static time_t
+parse_time(const char *str) {
+	static const char *formats[] = {
+		"%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%d %H:%M",
+		"%Y-%m-%d",
+		"%H:%M:%S",
+		"%H:%M"
+	};
+	time_t now = time(NULL);
+	struct tm tm;
+	size_t i;
+
+	if (!strcmp(str, "now"))
+		return now;
+
+	if (*str == '-' && isdigit((unsigned char) str[1])) {
+		char *end;
+		long n;
+
+		errno = 0;
+		n = strtol(str + 1, &end, 10);
+		if (errno || n < 0)
+			goto fail;
+		switch (*end) {
+		case 'd': n *= 24;		/* fallthrough */
+		case 'h': n *= 60;		/* fallthrough */
+		case 'm': n *= 60;		/* fallthrough */
+		case 's':
+			end++;
+		case '\0':
+			break;
+		default:
+			goto fail;
+		}
+		if (*end)
+			goto fail;
+		return now - n;
+	}
+
+	localtime_r(&now, &tm);
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+
+	if (!strcmp(str, "today"))
+		return mktime(&tm);
+	if (!strcmp(str, "yesterday")) {
+		tm.tm_mday--;
+		return mktime(&tm);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		struct tm res = tm;
+		char *end = strptime(str, formats[i], &res);
+
+		if (end && !*end) {
+			res.tm_isdst = -1;
+			return mktime(&res);
+		}
+	}
+fail:
+	errx(EXIT_FAILURE, _("invalid time value \"%s\""), str);
+}
+
 /*
  * hostconv --
  *	convert the hostname to search pattern; if the supplied host name
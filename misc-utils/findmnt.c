@@ -1449,6 +1449,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * Print lines as soon as possible for list-like output. The
+	 * --submounts and --poll modes need the complete table.
+	 */
+	if (!(tt_flags & TT_FL_TREE) && !(flags & (FL_SUBMOUNTS | FL_POLL)))
+		tt_set_stream(tt, TT_STREAM_LOOKAHEAD);
+
 	/*
 	 * Fill in data to the output table
 	 */
@@ -49,11 +49,17 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "c.h"
+#include "all-io.h"
 #include "closestream.h"
 #include "nls.h"
 #include "strutils.h"
+#include "xalloc.h"
 
 #define	SYSLOG_NAMES
 #include <syslog.h>
@@ -64,6 +70,39 @@ enum {
 	ALL_TYPES = TYPE_UDP | TYPE_TCP
 };
 
+#define LOGGER_BATCH_MAX	64		/* messages per sendmmsg() */
+#define LOGGER_BATCH_BUFSZ	(64 * 1024)	/* queued messages */
+#define LOGGER_LINE_MAX		1023		/* max input line, longer lines are split */
+
+/* --batch queue */
+struct logger_batch {
+	int		fd;
+	int		stream;		/* SOCK_STREAM, write the queue at once */
+	int		octet;		/* TCP, use octet counting */
+	int		pri;
+	int		logflags;
+	const char	*tag;		/* --tag or login name */
+	char		pid[30];	/* "[pid]" or empty string */
+
+	time_t		now;		/* time of the cached header */
+	char		header[300];	/* "<pri>Mmm dd hh:mm:ss tag[pid]: " */
+	size_t		headersz;
+
+	char		*buf;
+	size_t		bufused;
+	size_t		nmsgs;
+	struct iovec	iov[LOGGER_BATCH_MAX];	/* datagrams in buf */
+};
+
+/* --stats */
+static struct logger_stats {
+	uintmax_t	messages;
+	uintmax_t	bytes;
+	uintmax_t	syscalls;
+	uintmax_t	failed;
+	struct timeval	start;
+} stats;
+
 static int decode(char *name, CODE *codetab)
 {
 	register CODE *c;
@@ -204,11 +243,248 @@ mysyslog(int fd, int logflags, int pri, char *tag, char *msg) {
                snprintf(buf, sizeof(buf), "<%d>%.15s %.200s%s: %.400s",
 			pri, tp, cp, pid, msg);
 
-               if (write(fd, buf, strlen(buf)+1) < 0)
+	       stats.messages++;
+	       stats.syscalls++;
+               if (write(fd, buf, strlen(buf)+1) < 0) {
+		       stats.failed++;
                        return; /* error */
+	       }
+	       stats.bytes += strlen(buf) + 1;
        }
 }
 
+static void batch_init(struct logger_batch *bt, int fd, int logflags,
+		       int pri, const char *tag)
+{
+	int type = SOCK_DGRAM;
+	socklen_t sz = sizeof(type);
+
+	memset(bt, 0, sizeof(*bt));
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &sz) == 0)
+		bt->stream = type == SOCK_STREAM;
+	if (bt->stream) {
+		/* local syslog daemons expect zero terminated messages on
+		 * a Unix stream socket, octet counting is for TCP only */
+		struct sockaddr_storage addr;
+
+		sz = sizeof(addr);
+		if (getsockname(fd, (struct sockaddr *) &addr, &sz) == 0)
+			bt->octet = addr.ss_family == AF_INET ||
+				    addr.ss_family == AF_INET6;
+	}
+
+	bt->fd = fd;
+	bt->pri = pri;
+	bt->logflags = logflags;
+	bt->buf = xmalloc(LOGGER_BATCH_BUFSZ);
+
+	/* the same for all messages */
+	if (!tag) {
+		tag = getlogin();
+		if (!tag)
+			tag = "<someone>";
+	}
+	bt->tag = tag;
+	if (logflags & LOG_PID)
+		snprintf(bt->pid, sizeof(bt->pid), "[%d]", getpid());
+}
+
+/*
+ * The header is the same for all messages within one second.
+ */
+static void batch_update_header(struct logger_batch *bt)
+{
+	time_t now = time(NULL);
+	char tm[26];
+
+	if (bt->headersz && now == bt->now)
+		return;
+
+	ctime_r(&now, tm);
+	snprintf(bt->header, sizeof(bt->header), "<%d>%.15s %.200s%s: ",
+		 bt->pri, tm + 4, bt->tag, bt->pid);
+	bt->headersz = strlen(bt->header);
+	bt->now = now;
+}
+
+#ifdef HAVE_SENDMMSG
+static int batch_sendmmsg(struct logger_batch *bt)
+{
+	struct mmsghdr msgs[LOGGER_BATCH_MAX];
+	size_t i;
+
+	memset(msgs, 0, sizeof(struct mmsghdr) * bt->nmsgs);
+	for (i = 0; i < bt->nmsgs; i++) {
+		msgs[i].msg_hdr.msg_iov = &bt->iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; i < bt->nmsgs; ) {
+		int n = sendmmsg(bt->fd, msgs + i, bt->nmsgs - i, 0);
+
+		stats.syscalls++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS && i == 0)
+				return -ENOSYS;
+			stats.failed++;		/* skip the message */
+			i++;
+			continue;
+		}
+		for (; n > 0; n--, i++)
+			stats.bytes += bt->iov[i].iov_len;
+	}
+	return 0;
+}
+#endif
+
+static void batch_flush(struct logger_batch *bt)
+{
+	size_t i;
+
+	if (!bt->bufused)
+		return;
+
+	if (bt->stream) {
+		stats.syscalls++;
+		if (write_all(bt->fd, bt->buf, bt->bufused))
+			stats.failed += bt->nmsgs;
+		else
+			stats.bytes += bt->bufused;
+		goto done;
+	}
+#ifdef HAVE_SENDMMSG
+	if (batch_sendmmsg(bt) == 0)
+		goto done;
+#endif
+	/* no sendmmsg(), one datagram per syscall */
+	for (i = 0; i < bt->nmsgs; i++) {
+		stats.syscalls++;
+		if (write(bt->fd, bt->iov[i].iov_base, bt->iov[i].iov_len) < 0)
+			stats.failed++;
+		else
+			stats.bytes += bt->iov[i].iov_len;
+	}
+done:
+	bt->bufused = 0;
+	bt->nmsgs = 0;
+}
+
+/*
+ * Add message to the queue. The messages are terminated by zero like
+ * messages from mysyslog(), TCP uses RFC 6587 octet counting, that is
+ * "<length> <message>".
+ */
+static void batch_add(struct logger_batch *bt, const char *msg, size_t len)
+{
+	char *p;
+	size_t sz;
+
+	if (len > 400)
+		len = 400;
+	batch_update_header(bt);
+
+	sz = bt->headersz + len + (bt->octet ? 12 : 1);
+	if (bt->nmsgs == LOGGER_BATCH_MAX || bt->bufused + sz > LOGGER_BATCH_BUFSZ)
+		batch_flush(bt);
+
+	p = bt->buf + bt->bufused;
+	if (bt->octet)
+		p += sprintf(p, "%zu ", bt->headersz + len);
+	bt->iov[bt->nmsgs].iov_base = p;
+
+	memcpy(p, bt->header, bt->headersz);
+	p += bt->headersz;
+	memcpy(p, msg, len);
+	p += len;
+	if (!bt->octet)
+		*p++ = '\0';
+	bt->iov[bt->nmsgs].iov_len = p - (char *) bt->iov[bt->nmsgs].iov_base;
+
+	bt->bufused = p - bt->buf;
+	bt->nmsgs++;
+	stats.messages++;
+
+	if (bt->logflags & LOG_PERROR)
+		fprintf(stderr, "%s%s: %.*s\n", bt->tag, bt->pid, (int) len, msg);
+}
+
+/*
+ * Read lines from @fd and send them in batches. The queue is flushed when
+ * it is full or when there is no more input ready, so the messages are not
+ * delayed when the input is slow.
+ */
+static void batch_read(struct logger_batch *bt, int fd)
+{
+	char *buf = xmalloc(LOGGER_BATCH_BUFSZ);
+	size_t len = 0;
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		char *p, *end;
+		ssize_t n;
+
+		if (bt->nmsgs && poll(&pfd, 1, 0) == 0)
+			batch_flush(bt);
+
+		n = read(fd, buf + len, LOGGER_BATCH_BUFSZ - len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			err(EXIT_FAILURE, _("read failed"));
+		}
+		if (n == 0)
+			break;
+		len += n;
+
+		for (p = buf, end = buf + len; p < end; ) {
+			char *nl = memchr(p, '\n', end - p);
+
+			if (!nl) {
+				if (end - p < LOGGER_LINE_MAX)
+					break;	/* incomplete line */
+				batch_add(bt, p, LOGGER_LINE_MAX);
+				p += LOGGER_LINE_MAX;
+				continue;
+			}
+			if (nl - p > LOGGER_LINE_MAX) {
+				batch_add(bt, p, LOGGER_LINE_MAX);
+				p += LOGGER_LINE_MAX;
+				continue;
+			}
+			batch_add(bt, p, nl - p);
+			p = nl + 1;
+		}
+		len = end - p;
+		memmove(buf, p, len);
+	}
+
+	if (len)
+		batch_add(bt, buf, len);
+	batch_flush(bt);
+	free(buf);
+}
+
+static void print_stats(void)
+{
+	struct timeval now;
+	double sec;
+
+	gettimeofday(&now, NULL);
+	sec = (now.tv_sec - stats.start.tv_sec) +
+	      (now.tv_usec - stats.start.tv_usec) / 1000000.0;
+
+	fprintf(stderr, _("%s: %ju messages, %ju bytes, %ju failed, "
+			  "%ju system calls in %.3f seconds"),
+		program_invocation_short_name,
+		stats.messages, stats.bytes, stats.failed, stats.syscalls, sec);
+	if (sec > 0)
+		fprintf(stderr, _(", %.0f messages/s"), stats.messages / sec);
+	fputc('\n', stderr);
+}
+
 static void __attribute__ ((__noreturn__)) usage(FILE *out)
 {
 	fputs(_("\nUsage:\n"), out);
@@ -217,6 +493,8 @@ static void __attribute__ ((__noreturn__)) usage(FILE *out)
 
 	fputs(_("\nOptions:\n"), out);
 	fputs(_(" -T, --tcp             use TCP only\n"), out);
+	fputs(_("     --batch           send lines from input in batches\n"
+		"     --stats           print throughput statistics to stderr\n"), out);
 	fputs(_(" -d, --udp             use UDP only\n"
 		" -i, --id              log the process ID too\n"
 		" -f, --file <file>     log the contents of this file\n"
@@ -246,7 +524,12 @@ main(int argc, char **argv) {
 	char *server = NULL;
 	char *port = NULL;
 	int LogSock = -1, socket_type = ALL_TYPES;
+	int batch = 0, dostats = 0;
 
+	enum {
+		OPT_BATCH = CHAR_MAX + 1,
+		OPT_STATS
+	};
 	static const struct option longopts[] = {
 		{ "id",		no_argument,	    0, 'i' },
 		{ "stderr",	no_argument,	    0, 's' },
@@ -258,6 +541,8 @@ main(int argc, char **argv) {
 		{ "tcp",	no_argument,	    0, 'T' },
 		{ "server",	required_argument,  0, 'n' },
 		{ "port",	required_argument,  0, 'P' },
+		{ "batch",	no_argument,	    0, OPT_BATCH },
+		{ "stats",	no_argument,	    0, OPT_STATS },
 		{ "version",	no_argument,	    0, 'V' },
 		{ "help",	no_argument,	    0, 'h' },
 		{ NULL,		0, 0, 0 }
@@ -273,7 +558,7 @@ main(int argc, char **argv) {
 	logflags = 0;
 	while ((ch = getopt_long(argc, argv, "f:ip:st:u:dTn:P:Vh",
 					    longopts, NULL)) != -1) {
-		switch((char)ch) {
+		switch(ch) {
 		case 'f':		/* file to log */
 			if (freopen(optarg, "r", stdin) == NULL)
 				err(EXIT_FAILURE, _("file %s"),
@@ -306,6 +591,12 @@ main(int argc, char **argv) {
 		case 'P':
 			port = optarg;
 			break;
+		case OPT_BATCH:
+			batch = 1;
+			break;
+		case OPT_STATS:
+			dostats = 1;
+			break;
 		case 'V':
 			printf(UTIL_LINUX_VERSION);
 			exit(EXIT_SUCCESS);
@@ -319,6 +610,13 @@ main(int argc, char **argv) {
 	argc -= optind;
 	argv += optind;
 
+	if (dostats)
+		gettimeofday(&stats.start, NULL);
+
+	/* syslog(3) does not allow batching, talk to the local socket directly */
+	if (batch && !server && !usock)
+		usock = _PATH_LOG;
+
 	/* setup for logging */
 	if (server)
 		LogSock = inet_socket(server, port, socket_type);
@@ -359,6 +657,12 @@ main(int argc, char **argv) {
 		    else
 			mysyslog(LogSock, logflags, pri, tag, buf);
 		}
+	} else if (batch) {
+		struct logger_batch bt;
+
+		batch_init(&bt, LogSock, logflags, pri, tag);
+		batch_read(&bt, fileno(stdin));
+		free(bt.buf);
 	} else {
 		while (fgets(buf, sizeof(buf), stdin) != NULL) {
 		    /* glibc is buggy and adds an additional newline,
@@ -368,12 +672,15 @@ main(int argc, char **argv) {
 		    if (len > 0 && buf[len - 1] == '\n')
 			    buf[len - 1] = '\0';
 
-		    if (!usock && !server)
+		    if (!usock && !server) {
 			syslog(pri, "%s", buf);
-		    else
+			stats.messages++;
+		    } else
 			mysyslog(LogSock, logflags, pri, tag, buf);
 		}
 	}
+	if (dostats)
+		print_stats();
 	if (!usock && !server)
 		closelog();
 	else
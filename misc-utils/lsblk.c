@@ -38,6 +38,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <ctype.h>
+#include <sys/time.h>
 
 #include <blkid.h>
 #include <libmount.h>
@@ -168,6 +169,8 @@ struct lsblk {
 	unsigned int nodeps:1;		/* don't print slaves/holders */
 	unsigned int scsi:1;		/* print only device with HCTL (SCSI) */
 	unsigned int paths:1;		/* print devnames with "/dev" prefix */
+	unsigned int probe_all:1;	/* prefetch and probe all devices at once */
+	unsigned int debug:1;		/* LSBLK_DEBUG= is set */
 };
 
 struct lsblk *lsblk;	/* global handler */
@@ -182,6 +185,14 @@ static size_t nexcludes;
 static int includes[256];
 static size_t nincludes;
 
+/* sysfs attributes read by set_cxt() in one sweep */
+static const char *sysfs_attrs[NCOLS + 2];
+static size_t nsysfs_attrs;
+
+/* debug statistic */
+static size_t sysfs_ndevs, sysfs_nread;
+static struct timeval sysfs_time;
+
 static struct libmnt_table *mtab, *swaps;
 static struct libmnt_cache *mntcache;
 
@@ -452,6 +463,334 @@ static int get_udev_properties(struct blkdev_cxt *cxt)
 }
 #endif /* HAVE_LIBUDEV */
 
+/*
+ * Shared libblkid probe cache
+ *
+ * Without udev DB (initramfs, containers, ...) the devices are probed by
+ * libblkid, one dependent sequence of small reads per device. If all devices
+ * are listed then we open a batch of devices and ask kernel to read the
+ * probing areas (begin and end of the device) by POSIX_FADV_WILLNEED ahead
+ * of the probing, so the devices are read concurrently. The partition table
+ * is parsed only once per whole-disk, the PART_ENTRY_* values for the
+ * partitions are read from the whole-disk partlist.
+ *
+ * The results are sorted by devno and used by probe_device().
+ */
+#define PROBE_BATCH_SIZE	64
+#define PROBE_PREFETCH_SIZE	(256 * 1024)
+
+struct blkdev_probe {
+	dev_t	devno;
+	char	*name;		/* kernel name, deallocated after probing */
+	int	partition;	/* is partition? TRUE/FALSE */
+	dev_t	wholedisk;	/* partition's whole-disk */
+	int	fd;
+	uint64_t size;		/* device size in bytes */
+
+	char	*fstype;
+	char	*uuid;
+	char	*label;
+	char	*partuuid;
+	char	*partlabel;
+};
+
+static struct blkdev_probe *probes;
+static size_t nprobes;
+static int probes_ready;	/* already initialized */
+
+#ifndef HAVE_LIBUDEV
+static int has_udev_record(const char *name __attribute__((__unused__)))
+{
+	return 0;
+}
+#else
+static int has_udev_record(const char *name)
+{
+	struct udev_device *dev;
+
+	if (!udev)
+		udev = udev_new();
+	if (!udev)
+		return 0;
+
+	dev = udev_device_new_from_subsystem_sysname(udev, "block", name);
+	if (!dev)
+		return 0;
+	udev_device_unref(dev);
+	return 1;
+}
+#endif /* HAVE_LIBUDEV */
+
+/*
+ * Adds @name to the cache if it will be printed and probed by libblkid,
+ * the filters follow set_cxt() and iterate_block_devices(). Returns 0 if
+ * the device is printed.
+ */
+static int add_probe(const char *name, dev_t devno, struct sysfs_cxt *parent,
+		      int partition)
+{
+	struct sysfs_cxt sysfs;
+	struct blkdev_probe *x;
+	uint64_t size = 0;
+	int printed = 1;
+
+	if (sysfs_init(&sysfs, devno, parent))
+		return -1;
+	if (sysfs_read_u64(&sysfs, "size", &size) != 0)
+		size = 0;
+
+	if (!lsblk->all_devices && size == 0)
+		printed = 0;
+	else if (lsblk->scsi &&
+		 sysfs_scsi_get_hctl(&sysfs, NULL, NULL, NULL, NULL))
+		printed = 0;
+	else if (lsblk->nodeps && !partition &&
+		 sysfs_count_dirents(&sysfs, lsblk->inverse ?
+					"holders" : "slaves") > 0)
+		printed = 0;	/* in the middle of dependency tree */
+	sysfs_deinit(&sysfs);
+
+	if (!printed)
+		return -1;
+	if (!size || has_udev_record(name))
+		return 0;	/* not probed by libblkid */
+
+	if (nprobes % 32 == 0)
+		probes = xrealloc(probes, (nprobes + 32) * sizeof(*probes));
+	x = &probes[nprobes++];
+	memset(x, 0, sizeof(*x));
+
+	x->name = xstrdup(name);
+	x->devno = devno;
+	x->size = size << 9;
+	x->partition = partition;
+	x->wholedisk = parent ? parent->devno : 0;
+	x->fd = -1;
+	return 0;
+}
+
+/*
+ * Reads whole-disks and partitions names from /sys/block, the partitions
+ * follows the whole-disk.
+ */
+static void read_probes(void)
+{
+	DIR *dir;
+	struct dirent *d;
+
+	if (!(dir = opendir(_PATH_SYS_BLOCK)))
+		return;
+
+	while ((d = xreaddir(dir))) {
+		struct sysfs_cxt sysfs;
+		struct dirent *p;
+		DIR *pdir;
+		dev_t devno = sysfs_devname_to_devno(d->d_name, NULL);
+
+		if (!devno || is_maj_excluded(major(devno)) ||
+		    !is_maj_included(major(devno)))
+			continue;
+
+		if (add_probe(d->d_name, devno, NULL, 0) != 0)
+			continue;		/* ignored whole-disk */
+		if (lsblk->nodeps)
+			continue;		/* partitions are not printed */
+
+		if (sysfs_init(&sysfs, devno, NULL))
+			continue;
+		pdir = sysfs_opendir(&sysfs, NULL);
+		while (pdir && (p = xreaddir(pdir))) {
+			if (!sysfs_is_partition_dirent(pdir, p, d->d_name))
+				continue;
+			devno = sysfs_devname_to_devno(p->d_name, d->d_name);
+			if (devno)
+				add_probe(p->d_name, devno, &sysfs, 1);
+		}
+		if (pdir)
+			closedir(pdir);
+		sysfs_deinit(&sysfs);
+	}
+	closedir(dir);
+}
+
+static void prefetch_probe(struct blkdev_probe *x)
+{
+	struct blkdev_cxt cxt = { .name = x->name };
+	char *filename = get_device_path(&cxt);
+
+	x->fd = filename ? open(filename, O_RDONLY|O_CLOEXEC) : -1;
+	free(filename);
+	if (x->fd < 0)
+		return;
+
+	posix_fadvise(x->fd, 0, PROBE_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+	if (x->size > PROBE_PREFETCH_SIZE)
+		posix_fadvise(x->fd, x->size - PROBE_PREFETCH_SIZE,
+				PROBE_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Probes @x, @disk_pr is the whole-disk prober, the partition list is
+ * read from @disk_pr for partitions.
+ */
+static void do_probe(struct blkdev_probe *x, blkid_probe pr, blkid_probe disk_pr)
+{
+	const char *data = NULL;
+	int rc;
+
+	blkid_probe_enable_superblocks(pr, 1);
+	blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_LABEL |
+					      BLKID_SUBLKS_UUID |
+					      BLKID_SUBLKS_TYPE);
+	/*
+	 * BLKID_PARTS_ENTRY_DETAILS opens and parses the whole-disk partition
+	 * table for each partition again, it's necessary only if the
+	 * whole-disk has not been probed here.
+	 */
+	blkid_probe_enable_partitions(pr, 1);
+	if (x->partition && !disk_pr)
+		blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+	rc = blkid_do_safeprobe(pr);
+	if (rc == 0) {
+		if (!blkid_probe_lookup_value(pr, "TYPE", &data, NULL))
+			x->fstype = xstrdup(data);
+		if (!blkid_probe_lookup_value(pr, "UUID", &data, NULL))
+			x->uuid = xstrdup(data);
+		if (!blkid_probe_lookup_value(pr, "LABEL", &data, NULL))
+			x->label = xstrdup(data);
+		if (!blkid_probe_lookup_value(pr, "PART_ENTRY_UUID", &data, NULL))
+			x->partuuid = xstrdup(data);
+		if (!blkid_probe_lookup_value(pr, "PART_ENTRY_NAME", &data, NULL))
+			x->partlabel = xstrdup(data);
+	}
+
+	/* rc < 0 is ambivalent result or error, nothing is returned then */
+	if (rc >= 0 && x->partition && disk_pr) {
+		blkid_partlist ls = blkid_probe_get_partitions(disk_pr);
+		blkid_partition par = blkid_partlist_devno_to_partition(ls, x->devno);
+
+		if (par && (data = blkid_partition_get_uuid(par)))
+			x->partuuid = xstrdup(data);
+		if (par && (data = blkid_partition_get_name(par)))
+			x->partlabel = xstrdup(data);
+	}
+}
+
+static int cmp_probes(const void *a, const void *b)
+{
+	dev_t x = ((struct blkdev_probe *) a)->devno,
+	      y = ((struct blkdev_probe *) b)->devno;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void close_probe(struct blkdev_probe *x)
+{
+	if (x && x->fd >= 0) {
+		close(x->fd);
+		x->fd = -1;
+	}
+}
+
+static void init_probes(void)
+{
+	struct blkdev_probe *disk = NULL;
+	blkid_probe disk_pr = NULL;
+	size_t i, n;
+
+	probes_ready = 1;
+	read_probes();
+
+	for (i = 0; i < nprobes; i = n) {
+		/* prefetch the batch, the batch ends on whole-disk boundary */
+		for (n = i; n < nprobes; n++) {
+			if (n - i >= PROBE_BATCH_SIZE && !probes[n].partition)
+				break;
+			prefetch_probe(&probes[n]);
+		}
+
+		for (; i < n; i++) {
+			struct blkdev_probe *x = &probes[i];
+			blkid_probe pr = NULL;
+
+			if (!x->partition) {
+				blkid_free_probe(disk_pr);
+				close_probe(disk);
+				disk_pr = NULL;
+				disk = x;
+			}
+			if (x->fd >= 0 && (pr = blkid_new_probe())) {
+				/* the whole-disk may be not probed here */
+				blkid_probe dpr = x->partition && disk &&
+					disk->devno == x->wholedisk ? disk_pr : NULL;
+
+				if (blkid_probe_set_device(pr, x->fd, 0, 0) == 0)
+					do_probe(x, pr, dpr);
+				else {
+					blkid_free_probe(pr);
+					pr = NULL;
+				}
+			}
+			if (!x->partition) {
+				/* keep whole-disk prober (and fd) for the partitions */
+				disk_pr = pr;
+				continue;
+			}
+			blkid_free_probe(pr);
+			close_probe(x);
+		}
+	}
+
+	blkid_free_probe(disk_pr);
+	close_probe(disk);
+
+	for (i = 0; i < nprobes; i++) {
+		free(probes[i].name);
+		probes[i].name = NULL;
+	}
+	qsort(probes, nprobes, sizeof(*probes), cmp_probes);
+}
+
+static void free_probes(void)
+{
+	size_t i;
+
+	for (i = 0; i < nprobes; i++) {
+		free(probes[i].fstype);
+		free(probes[i].uuid);
+		free(probes[i].label);
+		free(probes[i].partuuid);
+		free(probes[i].partlabel);
+	}
+	free(probes);
+}
+
+/*
+ * Copies probing result from the shared cache to @cxt, returns 0 on success.
+ */
+static int get_cached_probe(struct blkdev_cxt *cxt)
+{
+	struct blkdev_probe key, *x;
+
+	if (!lsblk->probe_all)
+		return -1;
+	if (!probes_ready)
+		init_probes();
+
+	key.devno = makedev(cxt->maj, cxt->min);
+	x = bsearch(&key, probes, nprobes, sizeof(*probes), cmp_probes);
+	if (!x)
+		return -1;
+
+	cxt->fstype = x->fstype ? xstrdup(x->fstype) : NULL;
+	cxt->uuid = x->uuid ? xstrdup(x->uuid) : NULL;
+	cxt->label = x->label ? xstrdup(x->label) : NULL;
+	cxt->partuuid = x->partuuid ? xstrdup(x->partuuid) : NULL;
+	cxt->partlabel = x->partlabel ? xstrdup(x->partlabel) : NULL;
+	return 0;
+}
+
 static void probe_device(struct blkdev_cxt *cxt)
 {
 	blkid_probe pr = NULL;
@@ -472,6 +811,9 @@ static void probe_device(struct blkdev_cxt *cxt)
 	if (getuid() != 0)
 		return;				/* no permissions to read from the device */
 
+	if (get_cached_probe(cxt) == 0)
+		return;
+
 	pr = blkid_new_probe_from_filename(cxt->filename);
 	if (!pr)
 		return;
@@ -949,6 +1291,105 @@ static void set_tt_data(struct blkdev_cxt *cxt, int col, int id, struct tt_line
 	};
 }
 
+static void add_sysfs_attr(const char *attr)
+{
+	size_t i;
+
+	for (i = 0; i < nsysfs_attrs; i++) {
+		if (strcmp(sysfs_attrs[i], attr) == 0)
+			return;
+	}
+	assert(nsysfs_attrs < ARRAY_SIZE(sysfs_attrs));
+	sysfs_attrs[nsysfs_attrs++] = attr;
+}
+
+/*
+ * Composes list of sysfs attributes necessary for the output columns.
+ */
+static void init_sysfs_attrs(void)
+{
+	int i;
+
+	add_sysfs_attr("size");
+	add_sysfs_attr("queue/discard_granularity");
+
+	for (i = 0; i < ncolumns; i++) {
+		switch (get_column_id(i)) {
+		case COL_RA:
+			add_sysfs_attr("queue/read_ahead_kb");
+			break;
+		case COL_RO:
+			add_sysfs_attr("ro");
+			break;
+		case COL_RM:
+			add_sysfs_attr("removable");
+			break;
+		case COL_ROTA:
+			add_sysfs_attr("queue/rotational");
+			break;
+		case COL_RAND:
+			add_sysfs_attr("queue/add_random");
+			break;
+		case COL_ALIOFF:
+			add_sysfs_attr("alignment_offset");
+			break;
+		case COL_MINIO:
+			add_sysfs_attr("queue/minimum_io_size");
+			break;
+		case COL_OPTIO:
+			add_sysfs_attr("queue/optimal_io_size");
+			break;
+		case COL_PHYSEC:
+			add_sysfs_attr("queue/physical_block_size");
+			break;
+		case COL_LOGSEC:
+			add_sysfs_attr("queue/logical_block_size");
+			break;
+		case COL_SCHED:
+			add_sysfs_attr("queue/scheduler");
+			break;
+		case COL_RQ_SIZE:
+			add_sysfs_attr("queue/nr_requests");
+			break;
+		case COL_DALIGN:
+			add_sysfs_attr("discard_alignment");
+			break;
+		case COL_DMAX:
+			add_sysfs_attr("queue/discard_max_bytes");
+			break;
+		case COL_DZERO:
+			add_sysfs_attr("queue/discard_zeroes_data");
+			break;
+		case COL_WSAME:
+			add_sysfs_attr("queue/write_same_max_bytes");
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Reads all necessary attributes to the sysfs cache, the attributes are
+ * later used by set_tt_data() from the cache.
+ */
+static void read_sysfs_attrs(struct sysfs_cxt *sysfs)
+{
+	struct timeval start, end;
+
+	if (lsblk->debug)
+		gettimeofday(&start, NULL);
+
+	sysfs_nread += sysfs_read_attrs(sysfs, sysfs_attrs, nsysfs_attrs);
+	sysfs_ndevs++;
+
+	if (lsblk->debug) {
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &end);
+		timeradd(&sysfs_time, &end, &sysfs_time);
+	}
+}
+
 static void print_device(struct blkdev_cxt *cxt, struct tt_line *tt_parent)
 {
 	int i;
@@ -997,6 +1438,9 @@ static int set_cxt(struct blkdev_cxt *cxt,
 		}
 	}
 
+	/* attributes read before the filters below are cached as well */
+	sysfs_enable_cache(&cxt->sysfs);
+
 	cxt->maj = major(devno);
 	cxt->min = minor(devno);
 	cxt->size = 0;
@@ -1028,6 +1472,7 @@ static int set_cxt(struct blkdev_cxt *cxt,
 	if (lsblk->scsi && sysfs_scsi_get_hctl(&cxt->sysfs, NULL, NULL, NULL, NULL))
 		return -1;
 
+	read_sysfs_attrs(&cxt->sysfs);
 	return 0;
 }
 
@@ -1570,6 +2015,10 @@ int main(int argc, char *argv[])
 	if (nexcludes == 0 && nincludes == 0)
 		excludes[nexcludes++] = 1;	/* default: ignore RAM disks */
 
+	if (getenv("LSBLK_DEBUG"))
+		lsblk->debug = 1;
+	init_sysfs_attrs();
+
 	mnt_init_debug(0);
 
 	/*
@@ -1591,15 +2040,28 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (optind == argc)
+	/* the tree is always printed at once */
+	if (!(tt_flags & TT_FL_TREE))
+		tt_set_stream(lsblk->tt, TT_STREAM_LOOKAHEAD);
+
+	if (optind == argc) {
+		lsblk->probe_all = 1;
 		status = iterate_block_devices();
+	}
 	else while (optind < argc)
 		status = process_one_device(argv[optind++]);
 
 	tt_print_table(lsblk->tt);
 
+	if (lsblk->debug)
+		fprintf(stderr, "lsblk: sysfs: %zu attributes of %zu devices "
+				"read in %ld.%06ld sec\n", sysfs_nread, sysfs_ndevs,
+				(long) sysfs_time.tv_sec,
+				(long) sysfs_time.tv_usec);
+
 leave:
 	tt_free_table(lsblk->tt);
+	free_probes();
 	mnt_free_table(mtab);
 	mnt_free_table(swaps);
 	mnt_free_cache(mntcache);
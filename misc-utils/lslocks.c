@@ -99,6 +99,36 @@ struct lock {
 		     blocked   :1;
 	char *size;
 	int id;
+
+	dev_t dev;
+	ino_t inode;
+};
+
+/* descriptor of a process, as read from /proc/PID/fd */
+struct proc_fd {
+	ino_t inode;
+	size_t order;		/* readdir() position, first one wins */
+	off_t size;
+	char *path;
+};
+
+/* everything lslocks needs from one /proc/PID, read only once */
+struct proc {
+	pid_t pid;
+	char *cmdname;
+	struct proc_fd *fds;	/* sorted by inode */
+	size_t nfds;
+};
+
+/* open addressing table with int keys (OFD locks have PID -1) */
+struct idhash {
+	struct idhash_ent {
+		int id;
+		void *data;
+		unsigned int inuse :1;
+	} *ents;
+	size_t size;		/* power of two */
+	size_t used;
 };
 
 static void disable_columns_truncate(void)
@@ -109,6 +139,60 @@ static void disable_columns_truncate(void)
 		infos[i].flags &= ~TT_FL_TRUNC;
 }
 
+static void idhash_init(struct idhash *h, size_t hint)
+{
+	for (h->size = 64; h->size < hint * 2; h->size <<= 1)
+		;
+	h->ents = xcalloc(h->size, sizeof(*h->ents));
+	h->used = 0;
+}
+
+static struct idhash_ent *idhash_slot(struct idhash *h, int id)
+{
+	size_t i = ((unsigned int) id * 2654435761U) & (h->size - 1);
+
+	while (h->ents[i].inuse && h->ents[i].id != id)
+		i = (i + 1) & (h->size - 1);
+	return &h->ents[i];
+}
+
+static void *idhash_get(struct idhash *h, int id)
+{
+	struct idhash_ent *e = idhash_slot(h, id);
+
+	return e->inuse ? e->data : NULL;
+}
+
+/* keeps the first data added for an id */
+static void idhash_add(struct idhash *h, int id, void *data)
+{
+	struct idhash_ent *e = idhash_slot(h, id);
+
+	if (e->inuse)
+		return;
+	if ((h->used + 1) * 2 > h->size) {
+		struct idhash old = *h;
+		size_t i;
+
+		idhash_init(h, old.size);
+		for (i = 0; i < old.size; i++)
+			if (old.ents[i].inuse)
+				idhash_add(h, old.ents[i].id, old.ents[i].data);
+		free(old.ents);
+		e = idhash_slot(h, id);
+	}
+	e->id = id;
+	e->data = data;
+	e->inuse = 1;
+	h->used++;
+}
+
+static void idhash_free(struct idhash *h)
+{
+	free(h->ents);
+	h->ents = NULL;
+}
+
 /*
  * Return a PID's command name
  */
@@ -131,84 +215,144 @@ out:
 	return ret;
 }
 
-/*
- * Associate the device's mountpoint for a filename
- */
-static char *get_fallback_filename(dev_t dev)
+static int cmp_proc_fd(const void *a, const void *b)
 {
-	struct libmnt_fs *fs;
+	const struct proc_fd *x = a, *y = b;
 
-	if (!tab) {
-		tab = mnt_new_table_from_file(_PATH_PROC_MOUNTINFO);
-		if (!tab)
-			return NULL;
-	}
-
-	fs = mnt_table_find_devno(tab, dev, MNT_ITER_BACKWARD);
-	if (!fs)
-		return NULL;
-
-	return xstrdup(mnt_fs_get_target(fs));
+	if (x->inode != y->inode)
+		return x->inode < y->inode ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
 }
 
 /*
- * Return the absolute path of a file from
- * a given inode number (and its size)
+ * Read the inode, size and path of all the descriptors of a PID
  */
-static char *get_filename_sz(ino_t inode, pid_t pid, size_t *size)
+static void read_proc_fds(struct proc *pc)
 {
 	struct stat sb;
 	struct dirent *dp;
 	DIR *dirp;
-	size_t len;
+	ssize_t len;
+	size_t alloc = 0, order = 0;
 	int fd;
-	char path[PATH_MAX], sym[PATH_MAX], *ret = NULL;
-
-	*size = 0;
-	memset(path, 0, sizeof(path));
-	memset(sym, 0, sizeof(sym));
+	char path[PATH_MAX], sym[PATH_MAX];
 
 	/*
 	 * We know the pid so we don't have to
 	 * iterate the *entire* filesystem searching
 	 * for the damn file.
 	 */
-	sprintf(path, "/proc/%d/fd/", pid);
+	sprintf(path, "/proc/%d/fd/", pc->pid);
 	if (!(dirp = opendir(path)))
-		return NULL;
-
-	if ((len = strlen(path)) >= (sizeof(path) - 2))
-		goto out;
+		return;
 
 	if ((fd = dirfd(dirp)) < 0 )
 		goto out;
 
 	while ((dp = readdir(dirp))) {
-		if (!strcmp(dp->d_name, ".") ||
-		    !strcmp(dp->d_name, ".."))
-			continue;
+		struct proc_fd *f;
 
 		/* care only for numerical descriptors */
 		if (!strtol(dp->d_name, (char **) NULL, 10))
 			continue;
 
-		if (!fstat_at(fd, path, dp->d_name, &sb, 0)
-		    && inode != sb.st_ino)
+		if (fstat_at(fd, path, dp->d_name, &sb, 0) != 0)
 			continue;
 
-		if ((len = readlink_at(fd, path, dp->d_name,
-				       sym, sizeof(sym) - 1)) < 1)
-			goto out;
-
-		*size = sb.st_size;
-		sym[len] = '\0';
-
-		ret = xstrdup(sym);
-		break;
+		if (pc->nfds == alloc) {
+			alloc = alloc ? alloc * 2 : 32;
+			pc->fds = xrealloc(pc->fds, alloc * sizeof(*pc->fds));
+		}
+		f = &pc->fds[pc->nfds++];
+		f->inode = sb.st_ino;
+		f->order = order++;
+		f->size = sb.st_size;
+		f->path = NULL;
+
+		len = readlink_at(fd, path, dp->d_name, sym, sizeof(sym) - 1);
+		if (len > 0) {
+			sym[len] = '\0';
+			f->path = xstrdup(sym);
+		}
 	}
+
+	if (pc->nfds)
+		qsort(pc->fds, pc->nfds, sizeof(*pc->fds), cmp_proc_fd);
 out:
 	closedir(dirp);
-	return ret;
+}
+
+static struct proc *get_proc(struct idhash *procs, pid_t id)
+{
+	struct proc *pc = idhash_get(procs, id);
+
+	if (pc)
+		return pc;
+
+	pc = xcalloc(1, sizeof(*pc));
+	pc->pid = id;
+	pc->cmdname = get_cmdname(id);
+	read_proc_fds(pc);
+
+	idhash_add(procs, id, pc);
+	return pc;
+}
+
+static void free_proc(struct proc *pc)
+{
+	size_t i;
+
+	for (i = 0; i < pc->nfds; i++)
+		free(pc->fds[i].path);
+	free(pc->fds);
+	free(pc->cmdname);
+	free(pc);
+}
+
+/*
+ * Associate the device's mountpoint for a filename
+ */
+static char *get_fallback_filename(dev_t dev)
+{
+	struct libmnt_fs *fs;
+
+	if (!tab) {
+		tab = mnt_new_table_from_file(_PATH_PROC_MOUNTINFO);
+		if (!tab)
+			return NULL;
+	}
+
+	fs = mnt_table_find_devno(tab, dev, MNT_ITER_BACKWARD);
+	if (!fs)
+		return NULL;
+
+	return xstrdup(mnt_fs_get_target(fs));
+}
+
+/*
+ * Return the absolute path of a file from
+ * a given inode number (and its size)
+ */
+static char *get_filename_sz(struct proc *pc, ino_t inode, size_t *size)
+{
+	size_t lo = 0, hi = pc->nfds;
+
+	*size = 0;
+
+	/* the first descriptor in readdir() order of the inode */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (pc->fds[mid].inode < inode)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == pc->nfds || pc->fds[lo].inode != inode || !pc->fds[lo].path)
+		return NULL;
+
+	*size = pc->fds[lo].size;
+	return xstrdup(pc->fds[lo].path);
 }
 
 /*
@@ -225,15 +369,54 @@ static ino_t get_dev_inode(char *str, dev_t *dev)
 	return inum;
 }
 
+/*
+ * Fill in the command name, path and size of the locks from /proc/PID,
+ * which is read only once for all the locks held by the same PID
+ */
+static void get_lock_files(struct list_head *locks, size_t nlocks)
+{
+	struct list_head *p;
+	struct idhash procs;
+	char *szstr;
+	size_t i, sz;
+
+	idhash_init(&procs, nlocks);
+
+	list_for_each(p, locks) {
+		struct lock *l = list_entry(p, struct lock, locks);
+		struct proc *pc;
+
+		/* the others are filtered out by show_locks() */
+		if (pid && pid != l->pid)
+			continue;
+
+		pc = get_proc(&procs, l->pid);
+
+		l->cmdname = xstrdup(pc->cmdname ? pc->cmdname : _("(unknown)"));
+
+		l->path = get_filename_sz(pc, l->inode, &sz);
+		if (!l->path)
+			/* probably no permission to peek into l->pid's path */
+			l->path = get_fallback_filename(l->dev);
+
+		szstr = size_to_human_string(SIZE_SUFFIX_1LETTER, sz);
+		l->size = xstrdup(szstr);
+		free(szstr);
+	}
+
+	for (i = 0; i < procs.size; i++)
+		if (procs.ents[i].inuse)
+			free_proc(procs.ents[i].data);
+	idhash_free(&procs);
+}
+
 static int get_local_locks(struct list_head *locks)
 {
 	int i;
-	ino_t inode = 0;
 	FILE *fp;
-	char buf[PATH_MAX], *szstr = NULL, *tok = NULL;
-	size_t sz;
+	char buf[PATH_MAX], *tok = NULL;
+	size_t nlocks = 0;
 	struct lock *l;
-	dev_t dev = 0;
 
 	if (!(fp = fopen(_PATH_PROC_LOCKS, "r")))
 		return -1;
@@ -276,13 +459,10 @@ static int get_local_locks(struct list_head *locks)
 				 * to the list, no need to worry now.
 				 */
 				l->pid = strtos32_or_err(tok, _("failed to parse pid"));
-				l->cmdname = get_cmdname(l->pid);
-				if (!l->cmdname)
-					l->cmdname = xstrdup(_("(unknown)"));
 				break;
 
 			case 5: /* device major:minor and inode number */
-				inode = get_dev_inode(tok, &dev);
+				l->inode = get_dev_inode(tok, &l->dev);
 				break;
 
 			case 6: /* start */
@@ -299,22 +479,15 @@ static int get_local_locks(struct list_head *locks)
 			default:
 				break;
 			}
-
-			l->path = get_filename_sz(inode, l->pid, &sz);
-			if (!l->path)
-				/* probably no permission to peek into l->pid's path */
-				l->path = get_fallback_filename(dev);
-
-			/* avoid leaking */
-			szstr = size_to_human_string(SIZE_SUFFIX_1LETTER, sz);
-			l->size = xstrdup(szstr);
-			free(szstr);
 		}
 
 		list_add(&l->locks, locks);
+		nlocks++;
 	}
 
 	fclose(fp);
+
+	get_lock_files(locks, nlocks);
 	return 0;
 }
 
@@ -363,21 +536,14 @@ static void rem_lock(struct lock *lock)
 	free(lock);
 }
 
-static pid_t get_blocker(int id, struct list_head *locks)
+static pid_t get_blocker(int id, struct idhash *holders)
 {
-	struct list_head *p;
-
-	list_for_each(p, locks) {
-		struct lock *l = list_entry(p, struct lock, locks);
+	struct lock *l = idhash_get(holders, id);
 
-		if (l->id == id && !l->blocked)
-			return l->pid;
-	}
-
-	return 0;
+	return l ? l->pid : 0;
 }
 
-static void add_tt_line(struct tt *tt, struct lock *l, struct list_head *locks)
+static void add_tt_line(struct tt *tt, struct lock *l, struct idhash *holders)
 {
 	int i;
 	struct tt_line *line;
@@ -431,7 +597,7 @@ static void add_tt_line(struct tt *tt, struct lock *l, struct list_head *locks)
 		case COL_BLOCKER:
 		{
 			pid_t bl = l->blocked && l->id ?
-						get_blocker(l->id, locks) : 0;
+						get_blocker(l->id, holders) : 0;
 			if (bl)
 				xasprintf(&str, "%d", (int) bl);
 		}
@@ -449,6 +615,8 @@ static int show_locks(struct list_head *locks, int tt_flags)
 	int i, rc = 0;
 	struct list_head *p, *pnext;
 	struct tt *tt;
+	struct idhash holders;
+	size_t nlocks = 0;
 
 	tt = tt_new_table(tt_flags);
 	if (!tt) {
@@ -466,6 +634,17 @@ static int show_locks(struct list_head *locks, int tt_flags)
 		}
 	}
 
+	/* the first lock in the list with an ID blocks the others */
+	list_for_each(p, locks)
+		nlocks++;
+	idhash_init(&holders, nlocks);
+	list_for_each(p, locks) {
+		struct lock *l = list_entry(p, struct lock, locks);
+
+		if (!l->blocked)
+			idhash_add(&holders, l->id, l);
+	}
+
 	/* prepare data for output */
 	list_for_each(p, locks) {
 		struct lock *l = list_entry(p, struct lock, locks);
@@ -473,8 +652,9 @@ static int show_locks(struct list_head *locks, int tt_flags)
 		if (pid && pid != l->pid)
 			continue;
 
-		add_tt_line(tt, l, locks);
+		add_tt_line(tt, l, &holders);
 	}
+	idhash_free(&holders);
 
 	/* destroy the list */
 	list_for_each_safe(p, pnext, locks) {
@@ -48,6 +48,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include "xalloc.h"
 #include "nls.h"
@@ -68,6 +69,23 @@ enum {
 	ALL_DIRS = BIN_DIR | MAN_DIR | SRC_DIR
 };
 
+/* names of a directory hashed by every prefix filename_equal() may match */
+struct wh_dirindex {
+	char	**names;	/* entries in readdir() order */
+	size_t	nnames;
+
+	struct wh_dirkey {
+		const char *key;	/* prefix of one of the names */
+		size_t	keysz;
+		size_t	name;		/* index into names[] */
+		size_t	next;		/* next key in the bucket, or SIZE_MAX */
+	} *keys;
+	size_t	nkeys;
+
+	size_t	*buckets;
+	size_t	nbuckets;	/* power of two */
+};
+
 /* directories */
 struct wh_dirlist {
 	int	type;
@@ -75,6 +93,9 @@ struct wh_dirlist {
 	ino_t	st_ino;
 	char	*path;
 
+	struct wh_dirindex *index;	/* built by the second lookup */
+	int	nlookups;
+
 	struct wh_dirlist *next;
 };
 
@@ -309,6 +330,20 @@ static void construct_dirlist(struct wh_dirlist **ls,
 	return;
 }
 
+static void free_dirindex(struct wh_dirindex *ix)
+{
+	size_t i;
+
+	if (!ix)
+		return;
+	for (i = 0; i < ix->nnames; i++)
+		free(ix->names[i]);
+	free(ix->names);
+	free(ix->keys);
+	free(ix->buckets);
+	free(ix);
+}
+
 static void free_dirlist(struct wh_dirlist **ls0, int type)
 {
 	struct wh_dirlist *prev = NULL, *next, *ls = *ls0;
@@ -323,6 +358,7 @@ static void free_dirlist(struct wh_dirlist **ls0, int type)
 
 			DBG(printf("freeing dir: %s", ls->path));
 
+			free_dirindex(ls->index);
 			free(ls->path);
 			free(ls);
 			ls = next;
@@ -372,6 +408,21 @@ static int filename_equal(const char *cp, const char *dp)
 	return 0;
 }
 
+static void found(const char *dir, const char *name, const char *pattern,
+		  int *count, char **wait)
+{
+	if (uflag && *count == 0)
+		xasprintf(wait, "%s/%s", dir, name);
+
+	else if (uflag && *count == 1 && *wait) {
+		printf("%s: %s %s/%s", pattern, *wait, dir, name);
+		free(*wait);
+		*wait = NULL;
+	} else
+		printf(" %s/%s", dir, name);
+	++(*count);
+}
+
 static void findin(const char *dir, const char *pattern, int *count, char **wait)
 {
 	DIR *dirp;
@@ -386,20 +437,123 @@ static void findin(const char *dir, const char *pattern, int *count, char **wait
 	while ((dp = readdir(dirp)) != NULL) {
 		if (!filename_equal(pattern, dp->d_name))
 			continue;
+		found(dir, dp->d_name, pattern, count, wait);
+	}
+	closedir(dirp);
+	return;
+}
+
+static size_t hash_key(const char *key, size_t sz)
+{
+	size_t h = 2166136261U;
+
+	while (sz--)
+		h = (h ^ (unsigned char) *key++) * 16777619U;
+	return h;
+}
 
-		if (uflag && *count == 0)
-			xasprintf(wait, "%s/%s", dir, dp->d_name);
+static void dirindex_add_key(struct wh_dirindex *ix, size_t *keysalloc,
+			     const char *key, size_t sz, size_t name)
+{
+	struct wh_dirkey *k;
 
-		else if (uflag && *count == 1 && *wait) {
-			printf("%s: %s %s/%s", pattern, *wait, dir,  dp->d_name);
-			free(*wait);
-			*wait = NULL;
-		} else
-			printf(" %s/%s", dir, dp->d_name);
-		++(*count);
+	if (ix->nkeys == *keysalloc) {
+		*keysalloc = *keysalloc ? *keysalloc * 2 : 256;
+		ix->keys = xrealloc(ix->keys, *keysalloc * sizeof(*ix->keys));
+	}
+	k = &ix->keys[ix->nkeys++];
+	k->key = key;
+	k->keysz = sz;
+	k->name = name;
+}
+
+/*
+ * filename_equal() matches when the pattern is the whole name, or a prefix
+ * of it followed by digits and a dot; try the same after an "s." prefix.
+ */
+static void dirindex_add_name(struct wh_dirindex *ix, size_t *keysalloc,
+			      const char *name, size_t idx)
+{
+	size_t j, k;
+
+	if (name[0] == 's' && name[1] == '.')
+		dirindex_add_name(ix, keysalloc, name + 2, idx);
+
+	dirindex_add_key(ix, keysalloc, name, strlen(name), idx);
+
+	for (j = 0; name[j]; j++) {
+		if (name[j] != '.')
+			continue;
+		for (k = j; k > 0 && isdigit(name[k - 1]); k--)
+			;
+		for (; k <= j; k++)
+			dirindex_add_key(ix, keysalloc, name, k, idx);
+	}
+}
+
+static struct wh_dirindex *dirindex_create(const char *dir)
+{
+	struct wh_dirindex *ix;
+	DIR *dirp;
+	struct dirent *dp;
+	size_t i, namesalloc = 0, keysalloc = 0;
+
+	dirp = opendir(dir);
+	if (dirp == NULL)
+		return NULL;
+
+	DBG(printf("index '%s'", dir));
+
+	ix = xcalloc(1, sizeof(*ix));
+	while ((dp = readdir(dirp)) != NULL) {
+		if (ix->nnames == namesalloc) {
+			namesalloc = namesalloc ? namesalloc * 2 : 256;
+			ix->names = xrealloc(ix->names,
+					namesalloc * sizeof(*ix->names));
+		}
+		ix->names[ix->nnames++] = xstrdup(dp->d_name);
 	}
 	closedir(dirp);
-	return;
+
+	for (i = 0; i < ix->nnames; i++)
+		dirindex_add_name(ix, &keysalloc, ix->names[i], i);
+
+	for (ix->nbuckets = 64; ix->nbuckets < ix->nkeys; ix->nbuckets <<= 1)
+		;
+	ix->buckets = xmalloc(ix->nbuckets * sizeof(*ix->buckets));
+	for (i = 0; i < ix->nbuckets; i++)
+		ix->buckets[i] = SIZE_MAX;
+
+	/* chain backwards so that every bucket lists names in readdir() order */
+	for (i = ix->nkeys; i > 0; i--) {
+		struct wh_dirkey *k = &ix->keys[i - 1];
+		size_t b = hash_key(k->key, k->keysz) & (ix->nbuckets - 1);
+
+		k->next = ix->buckets[b];
+		ix->buckets[b] = i - 1;
+	}
+	return ix;
+}
+
+static void findin_index(const char *dir, struct wh_dirindex *ix,
+			 const char *pattern, int *count, char **wait)
+{
+	size_t sz = strlen(pattern), i, last = SIZE_MAX;
+
+	DBG(printf("find '%s' in '%s' index", pattern, dir));
+
+	i = ix->buckets[hash_key(pattern, sz) & (ix->nbuckets - 1)];
+	for (; i != SIZE_MAX; i = ix->keys[i].next) {
+		const struct wh_dirkey *k = &ix->keys[i];
+
+		/* one name may be listed under the same key more than once */
+		if (k->name == last || k->keysz != sz
+		    || memcmp(k->key, pattern, sz) != 0)
+			continue;
+		last = k->name;
+		if (filename_equal(pattern, ix->names[k->name]))
+			found(dir, ix->names[k->name], pattern, count, wait);
+	}
 }
 
 static void lookup(const char *pattern, struct wh_dirlist *ls, int want)
@@ -424,7 +578,14 @@ static void lookup(const char *pattern, struct wh_dirlist *ls, int want)
 		printf("%s:", patbuf);
 
 	for (; ls; ls = ls->next) {
-		if ((ls->type & want) && ls->path)
+		if (!(ls->type & want) || !ls->path)
+			continue;
+		/* a directory searched for more names is read only once more */
+		if (!ls->index && ls->nlookups++ == 1)
+			ls->index = dirindex_create(ls->path);
+		if (ls->index)
+			findin_index(ls->path, ls->index, patbuf, &count, &wait);
+		else
 			findin(ls->path, patbuf, &count, &wait);
 	}
 
@@ -33,9 +33,33 @@
 #include "strutils.h"
 #include "xalloc.h"
 #include "procutils.h"
+#include "path.h"
 #include "c.h"
 #include "closestream.h"
 
+#define _PATH_SYS_SYSTEM	"/sys/devices/system"
+#define _PATH_SYS_CPU		_PATH_SYS_SYSTEM "/cpu"
+#define _PATH_SYS_NODE		_PATH_SYS_SYSTEM "/node"
+
+/* placement policies */
+enum {
+	PLACE_NONE = 0,
+	PLACE_COMPACT,		/* fill cores and sockets one by one */
+	PLACE_SPREAD_CORE,	/* one task per core, then SMT siblings */
+	PLACE_SPREAD_SOCKET,	/* round-robin over sockets */
+	PLACE_SPREAD_NUMA	/* round-robin over NUMA nodes */
+};
+
+/* CPU topology for placement */
+struct place_cpu {
+	int	cpu;
+	int	core;		/* the first CPU of thread_siblings */
+	int	socket;		/* the first CPU of core_siblings */
+	int	node;		/* NUMA node */
+	int	smt;		/* index of the CPU within the core */
+	int	rank;		/* index of the core within the socket or node */
+};
+
 struct taskset {
 	pid_t		pid;		/* task PID */
 	cpu_set_t	*set;		/* task CPU mask */
@@ -57,6 +81,8 @@ static void __attribute__((__noreturn__)) usage(FILE *out)
 		" -a, --all-tasks         operate on all the tasks (threads) for a given pid\n"
 		" -p, --pid               operate on existing given pid\n"
 		" -c, --cpu-list          display and specify cpus in list format\n"
+		"     --compact           place tasks on neighbouring cpus\n"
+		"     --spread <level>    spread tasks over core, socket or numa\n"
 		" -h, --help              display this help\n"
 		" -V, --version           output version information\n\n"));
 
@@ -125,19 +151,231 @@ static void do_taskset(struct taskset *ts, size_t setsize, cpu_set_t *set)
 	}
 }
 
+static int first_cpu(cpu_set_t *set, size_t setsize, int nbits)
+{
+	int i;
+
+	for (i = 0; i < nbits; i++)
+		if (CPU_ISSET_S(i, setsize, set))
+			return i;
+	return -1;
+}
+
+static int cmp_group_core(const void *a, const void *b)
+{
+	const struct place_cpu *x = a, *y = b;
+
+	/* rank is temporarily used for the group ID */
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static int cmp_compact(const void *a, const void *b)
+{
+	const struct place_cpu *x = a, *y = b;
+
+	if (x->node != y->node)
+		return x->node - y->node;
+	if (x->socket != y->socket)
+		return x->socket - y->socket;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static int cmp_spread_core(const void *a, const void *b)
+{
+	const struct place_cpu *x = a, *y = b;
+
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	return cmp_compact(a, b);
+}
+
+static int cmp_spread_socket(const void *a, const void *b)
+{
+	const struct place_cpu *x = a, *y = b;
+
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	if (x->socket != y->socket)
+		return x->socket - y->socket;
+	return x->cpu - y->cpu;
+}
+
+static int cmp_spread_numa(const void *a, const void *b)
+{
+	const struct place_cpu *x = a, *y = b;
+
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	if (x->node != y->node)
+		return x->node - y->node;
+	return x->cpu - y->cpu;
+}
+
+/*
+ * Returns CPUs from @pool in order defined by the placement @policy. The
+ * topology is read from sysfs in the same way as lscpu(1) does.
+ */
+static struct place_cpu *get_placement(int policy, cpu_set_t *pool,
+				       size_t setsize, int nbits, int *ncpus)
+{
+	struct place_cpu *cpus;
+	cpu_set_t **nodemaps = NULL, *online = NULL;
+	int i, n = 0, nnodes = 0;
+
+	*ncpus = CPU_COUNT_S(setsize, pool);
+	if (!*ncpus)
+		return NULL;
+	cpus = xcalloc(*ncpus, sizeof(struct place_cpu));
+
+	/* offline and not existing CPUs are ignored */
+	if (path_exist(_PATH_SYS_CPU "/online"))
+		online = path_read_cpulist(nbits, _PATH_SYS_CPU "/online");
+
+	/* the node IDs may be sparse, "possible" uses the same format as CPU lists */
+	if (path_exist(_PATH_SYS_NODE "/possible")) {
+		cpu_set_t *ids = path_read_cpulist(nbits, _PATH_SYS_NODE "/possible");
+
+		for (i = 0; i < nbits; i++)
+			if (CPU_ISSET_S(i, setsize, ids))
+				nnodes = i + 1;
+		cpuset_free(ids);
+	} else {
+		while (path_exist(_PATH_SYS_NODE "/node%d", nnodes))
+			nnodes++;
+	}
+	if (nnodes) {
+		nodemaps = xcalloc(nnodes, sizeof(cpu_set_t *));
+		for (i = 0; i < nnodes; i++)
+			nodemaps[i] = path_try_read_cpuset(nbits,
+					_PATH_SYS_NODE "/node%d/cpumap", i);
+	}
+
+	for (i = 0; i < nbits && n < *ncpus; i++) {
+		struct place_cpu *pc = &cpus[n];
+		cpu_set_t *set;
+		int j;
+
+		if (!CPU_ISSET_S(i, setsize, pool))
+			continue;
+		if (online && !CPU_ISSET_S(i, setsize, online))
+			continue;
+
+		pc->cpu = pc->core = i;
+		set = path_try_read_cpuset(nbits, _PATH_SYS_CPU
+				"/cpu%d/topology/thread_siblings", i);
+		if (set) {
+			pc->core = first_cpu(set, setsize, nbits);
+			/* siblings before this CPU */
+			for (j = 0; j < i; j++)
+				if (CPU_ISSET_S(j, setsize, set) &&
+				    CPU_ISSET_S(j, setsize, pool))
+					pc->smt++;
+			cpuset_free(set);
+		}
+		set = path_try_read_cpuset(nbits, _PATH_SYS_CPU
+				"/cpu%d/topology/core_siblings", i);
+		if (set) {
+			pc->socket = first_cpu(set, setsize, nbits);
+			cpuset_free(set);
+		}
+		for (j = 0; j < nnodes; j++) {
+			if (nodemaps[j] && CPU_ISSET_S(i, setsize, nodemaps[j])) {
+				pc->node = j;
+				break;
+			}
+		}
+		n++;
+	}
+	*ncpus = n;
+
+	if (online)
+		cpuset_free(online);
+	for (i = 0; i < nnodes; i++)
+		if (nodemaps[i])
+			cpuset_free(nodemaps[i]);
+	free(nodemaps);
+
+	if (!n) {
+		free(cpus);
+		return NULL;
+	}
+
+	/* index of the core within socket or node */
+	if (policy == PLACE_SPREAD_SOCKET || policy == PLACE_SPREAD_NUMA) {
+		int rank = 0, group = 0;
+
+		for (i = 0; i < n; i++)
+			cpus[i].rank = policy == PLACE_SPREAD_SOCKET ?
+					cpus[i].socket : cpus[i].node;
+		qsort(cpus, n, sizeof(struct place_cpu), cmp_group_core);
+
+		for (i = 0; i < n; i++) {
+			if (i == 0 || cpus[i].rank != group)
+				rank = 0;
+			else if (cpus[i].core != cpus[i - 1].core)
+				rank++;
+			group = cpus[i].rank;
+			cpus[i].rank = rank;
+		}
+	}
+
+	switch (policy) {
+	case PLACE_COMPACT:
+		qsort(cpus, n, sizeof(struct place_cpu), cmp_compact);
+		break;
+	case PLACE_SPREAD_CORE:
+		qsort(cpus, n, sizeof(struct place_cpu), cmp_spread_core);
+		break;
+	case PLACE_SPREAD_SOCKET:
+		qsort(cpus, n, sizeof(struct place_cpu), cmp_spread_socket);
+		break;
+	case PLACE_SPREAD_NUMA:
+		qsort(cpus, n, sizeof(struct place_cpu), cmp_spread_numa);
+		break;
+	}
+	return cpus;
+}
+
+/* sets the next CPU from @cpus as the only CPU in @set */
+static void next_placement(struct place_cpu *cpus, int ncpus, int *idx,
+			   cpu_set_t *set, size_t setsize)
+{
+	CPU_ZERO_S(setsize, set);
+	CPU_SET_S(cpus[*idx % ncpus].cpu, setsize, set);
+	++*idx;
+}
+
 int main(int argc, char **argv)
 {
 	cpu_set_t *new_set;
 	pid_t pid = 0;
 	int c, all_tasks = 0;
-	int ncpus;
+	int ncpus, policy = PLACE_NONE;
 	size_t new_setsize, nbits;
 	struct taskset ts;
+	struct place_cpu *cpus = NULL;
+	int ncpus_placed = 0, idx = 0;
 
+	enum {
+		OPT_COMPACT = CHAR_MAX + 1,
+		OPT_SPREAD
+	};
 	static const struct option longopts[] = {
 		{ "all-tasks",	0, NULL, 'a' },
 		{ "pid",	0, NULL, 'p' },
 		{ "cpu-list",	0, NULL, 'c' },
+		{ "compact",	0, NULL, OPT_COMPACT },
+		{ "spread",	1, NULL, OPT_SPREAD },
 		{ "help",	0, NULL, 'h' },
 		{ "version",	0, NULL, 'V' },
 		{ NULL,		0, NULL,  0  }
@@ -162,6 +400,20 @@ int main(int argc, char **argv)
 		case 'c':
 			ts.use_list = 1;
 			break;
+		case OPT_COMPACT:
+			policy = PLACE_COMPACT;
+			break;
+		case OPT_SPREAD:
+			if (strcmp(optarg, "core") == 0)
+				policy = PLACE_SPREAD_CORE;
+			else if (strcmp(optarg, "socket") == 0)
+				policy = PLACE_SPREAD_SOCKET;
+			else if (strcmp(optarg, "numa") == 0)
+				policy = PLACE_SPREAD_NUMA;
+			else
+				errx(EXIT_FAILURE, _("unsupported spread level: %s"),
+				     optarg);
+			break;
 		case 'V':
 			printf(_("%s from %s\n"), program_invocation_short_name,
 			       PACKAGE_STRING);
@@ -175,6 +427,8 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (policy && !pid)
+		errx(EXIT_FAILURE, _("--compact and --spread require --pid"));
 	if ((!pid && argc - optind < 2)
 	    || (pid && (argc - optind < 1 || argc - optind > 2)))
 		usage(stderr);
@@ -205,7 +459,12 @@ int main(int argc, char **argv)
 	if (!new_set)
 		err(EXIT_FAILURE, _("cpuset_alloc failed"));
 
-	if (argc - optind == 1)
+	if (argc - optind == 1 && policy) {
+		/* place within the current affinity of the process */
+		if (sched_getaffinity(pid, new_setsize, new_set) < 0)
+			err(EXIT_FAILURE, _("failed to get pid %d's affinity"), pid);
+
+	} else if (argc - optind == 1)
 		ts.get_only = 1;
 
 	else if (ts.use_list) {
@@ -217,16 +476,31 @@ int main(int argc, char **argv)
 		     argv[optind]);
 	}
 
+	if (policy) {
+		cpus = get_placement(policy, new_set, new_setsize,
+				     nbits, &ncpus_placed);
+		if (!cpus)
+			errx(EXIT_FAILURE, _("no CPU available for placement"));
+	}
+
 	if (all_tasks && pid) {
 		struct proc_tasks *tasks = proc_open_tasks(pid);
-		while (!proc_next_tid(tasks, &ts.pid))
+		while (!proc_next_tid(tasks, &ts.pid)) {
+			if (cpus)
+				next_placement(cpus, ncpus_placed, &idx,
+					       new_set, new_setsize);
 			do_taskset(&ts, new_setsize, new_set);
+		}
 		proc_close_tasks(tasks);
 	} else {
 		ts.pid = pid;
+		if (cpus)
+			next_placement(cpus, ncpus_placed, &idx,
+				       new_set, new_setsize);
 		do_taskset(&ts, new_setsize, new_set);
 	}
 
+	free(cpus);
 	free(ts.buf);
 	cpuset_free(ts.set);
 	cpuset_free(new_set);
@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "c.h"
 #include "colors.h"
@@ -34,6 +35,8 @@
 #include "optutils.h"
 #include "mangle.h"
 #include "pager.h"
+#include "fileutils.h"
+#include "pathnames.h"
 
 /* Close the log.  Currently a NOP. */
 #define SYSLOG_ACTION_CLOSE          0
@@ -144,6 +147,15 @@ struct dmesg_control {
 	ssize_t		kmsg_first_read;/* initial read() return code */
 	char		kmsg_buf[BUFSIZ];/* buffer to read kmsg data */
 
+	/*
+	 * Cursor (see --since-seq and --cursor-file), records with sequence
+	 * number less or equal to kmsg_last_seq are skipped.
+	 */
+	char		*cursor_file;	/* file to load/store the last seqnum */
+	int64_t		kmsg_last_seq;	/* last read seqnum or -1 */
+	int64_t		kmsg_saved_seq;	/* seqnum stored in cursor file or -1 */
+	char		boot_id[37];	/* cursor is valid for this boot only */
+
 	/*
 	 * For the --file option we mmap whole file. The unnecessary (already
 	 * printed) pages are always unmapped. The result is that we have in
@@ -163,15 +175,31 @@ struct dmesg_control {
 			reltime:1,	/* show human readable relative times */
 			ctime:1,	/* show human readable time */
 			pager:1,	/* pipe output into a pager */
-			color:1;	/* colorize messages */
+			color:1,	/* colorize messages */
+			json:1,		/* newline-delimited JSON output */
+			binary:1;	/* binary framed output */
 };
 
+/*
+ * --binary output record header. All fields are little-endian, the header is
+ * followed by @size bytes of the message text (without the terminating
+ * newline). The @seqnum is -1 if the record does not come from /dev/kmsg.
+ */
+struct dmesg_binhdr {
+	int64_t		seqnum;
+	uint64_t	usec;		/* timestamp in microseconds */
+	uint32_t	size;		/* size of the message text */
+	int16_t		faclev;		/* LOG_MAKEPRI(facility, level) or -1 */
+	uint16_t	reserved;
+} __attribute__ ((__packed__));
+
 struct dmesg_record {
 	const char	*mesg;
 	size_t		mesg_size;
 
 	int		level;
 	int		facility;
+	int64_t		seqnum;		/* /dev/kmsg sequence number or -1 */
 	struct timeval  tv;
 
 	const char	*next;		/* buffer with next unparsed record */
@@ -183,6 +211,7 @@ struct dmesg_record {
 		(_r)->mesg_size = 0; \
 		(_r)->facility = -1; \
 		(_r)->level = -1; \
+		(_r)->seqnum = -1; \
 		(_r)->tv.tv_sec = 0; \
 		(_r)->tv.tv_usec = 0; \
 	} while (0)
@@ -235,6 +264,10 @@ static void __attribute__((__noreturn__)) usage(FILE *out)
 	fputs(_(" -F, --file <file>           use the file instead of the kernel log buffer\n"), out);
 	fputs(_(" -f, --facility <list>       restrict output to defined facilities\n"), out);
 	fputs(_(" -H, --human                 human readable output\n"), out);
+	fputs(_(" -J, --json                  use JSON output format, one record per line\n"), out);
+	fputs(_("     --binary                use binary framed output format\n"), out);
+	fputs(_("     --since-seq <seqnum>    print only messages with greater sequence number\n"), out);
+	fputs(_("     --cursor-file <file>    load and store the last read sequence number\n"), out);
 	fputs(_(" -k, --kernel                display kernel messages\n"), out);
 	fputs(_(" -L, --color                 colorize messages\n"), out);
 	fputs(_(" -l, --level <list>          restrict output to defined levels\n"), out);
@@ -448,7 +481,6 @@ static const char *parse_kmsg_timestamp(const char *str0, struct timeval *tv)
 	return end + 1;	/* skip separator */
 }
 
-
 static double time_diff(struct timeval *a, struct timeval *b)
 {
 	return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1E6;
@@ -680,7 +712,8 @@ static int get_next_syslog_record(struct dmesg_control *ctl,
 			continue;	/* error or empty line? */
 
 		if (*begin == '<') {
-			if (ctl->fltr_lev || ctl->fltr_fac || ctl->decode || ctl->color)
+			if (ctl->fltr_lev || ctl->fltr_fac || ctl->decode ||
+			    ctl->color || ctl->json || ctl->binary)
 				begin = parse_faclev(begin + 1, &rec->facility,
 						     &rec->level);
 			else
@@ -689,7 +722,8 @@ static int get_next_syslog_record(struct dmesg_control *ctl,
 
 		if (*begin == '[' && (*(begin + 1) == ' ' ||
 				      isdigit(*(begin + 1)))) {
-			if (ctl->delta || ctl->ctime || ctl->reltime)
+			if (ctl->delta || ctl->ctime || ctl->reltime ||
+			    ctl->json || ctl->binary)
 				begin = parse_syslog_timestamp(begin + 1, &rec->tv);
 			else if (ctl->notime)
 				begin = skip_item(begin, end, "]");
@@ -814,6 +848,84 @@ static const char *get_subsys_delimiter(const char *mesg, size_t mesg_size)
 	return NULL;
 }
 
+/*
+ * Returns message size without the terminating newline
+ */
+static size_t record_mesg_size(struct dmesg_record *rec)
+{
+	size_t sz = rec->mesg_size;
+
+	if (sz && rec->mesg[sz - 1] == '\n')
+		sz--;
+	return sz;
+}
+
+static void fputs_json_str(const char *str, size_t size, FILE *out)
+{
+	const char *p;
+
+	putc('"', out);
+	for (p = str; p < str + size; p++) {
+		unsigned char c = (unsigned char) *p;
+
+		switch (c) {
+		case '"':
+			fputs("\\\"", out);
+			break;
+		case '\\':
+			fputs("\\\\", out);
+			break;
+		case '\n':
+			fputs("\\n", out);
+			break;
+		case '\t':
+			fputs("\\t", out);
+			break;
+		default:
+			if (c < 0x20 || c == 0x7f)
+				fprintf(out, "\\u%04x", c);
+			else
+				putc(c, out);
+			break;
+		}
+	}
+	putc('"', out);
+}
+
+/*
+ * Prints record as one JSON object per line, the "seq" item is available for
+ * /dev/kmsg records only.
+ */
+static void print_record_json(struct dmesg_record *rec)
+{
+	fputc('{', stdout);
+	if (rec->seqnum >= 0)
+		printf("\"seq\":%" PRId64 ",", rec->seqnum);
+	if (rec->facility >= 0 && rec->level >= 0)
+		printf("\"pri\":%d,", LOG_MAKEPRI(rec->facility, rec->level));
+	printf("\"time\":%ld.%06ld,\"msg\":",
+			(long) rec->tv.tv_sec, (long) rec->tv.tv_usec);
+	fputs_json_str(rec->mesg, record_mesg_size(rec), stdout);
+	fputs("}\n", stdout);
+}
+
+static void print_record_binary(struct dmesg_record *rec)
+{
+	struct dmesg_binhdr hdr;
+	size_t sz = record_mesg_size(rec);
+
+	hdr.seqnum = htole64(rec->seqnum);
+	hdr.usec = htole64((uint64_t) rec->tv.tv_sec * 1000000 + rec->tv.tv_usec);
+	hdr.size = htole32(sz);
+	hdr.faclev = htole16(rec->facility >= 0 && rec->level >= 0 ?
+			LOG_MAKEPRI(rec->facility, rec->level) : -1);
+	hdr.reserved = 0;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, stdout) != 1 ||
+	    (sz && fwrite(rec->mesg, sz, 1, stdout) != 1))
+		err(EXIT_FAILURE, _("write failed"));
+}
+
 static void print_record(struct dmesg_control *ctl,
 			 struct dmesg_record *rec)
 {
@@ -825,6 +937,15 @@ static void print_record(struct dmesg_control *ctl,
 	if (!accept_record(ctl, rec))
 		return;
 
+	if (ctl->json) {
+		print_record_json(rec);
+		return;
+	}
+	if (ctl->binary) {
+		print_record_binary(rec);
+		return;
+	}
+
 	if (!rec->mesg_size) {
 		putchar('\n');
 		return;
@@ -987,12 +1108,11 @@ static ssize_t read_kmsg_one(struct dmesg_control *ctl)
 
 static int init_kmsg(struct dmesg_control *ctl)
 {
-	int mode = O_RDONLY;
-
-	if (!ctl->follow)
-		mode |= O_NONBLOCK;
-
-	ctl->kmsg = open("/dev/kmsg", mode);
+	/*
+	 * The descriptor is always non-blocking, in --follow mode we wait for
+	 * new records by poll() in read_kmsg().
+	 */
+	ctl->kmsg = open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
 	if (ctl->kmsg < 0)
 		return -1;
 
@@ -1001,17 +1121,25 @@ static int init_kmsg(struct dmesg_control *ctl)
 	 * the last SYSLOG_ACTION_CLEAR was issued.
 	 *
 	 * ... otherwise SYSLOG_ACTION_CLEAR will have no effect for kmsg.
+	 *
+	 * The cursor is independent on SYSLOG_ACTION_CLEAR, all records
+	 * after the cursor are wanted.
 	 */
-	lseek(ctl->kmsg, 0, SEEK_DATA);
+	if (ctl->kmsg_last_seq >= 0)
+		lseek(ctl->kmsg, 0, SEEK_SET);
+	else
+		lseek(ctl->kmsg, 0, SEEK_DATA);
 
 	/*
 	 * Old kernels (<3.5) allow to successfully open /dev/kmsg for
 	 * read-only, but read() returns -EINVAL :-(((
 	 *
 	 * Let's try to read the first record. The record is later processed in
-	 * read_kmsg().
+	 * read_kmsg(). EAGAIN means that the buffer is empty (cleared).
 	 */
 	ctl->kmsg_first_read = read_kmsg_one(ctl);
+	if (ctl->kmsg_first_read < 0 && errno == EAGAIN)
+		ctl->kmsg_first_read = 0;
 	if (ctl->kmsg_first_read < 0) {
 		close(ctl->kmsg);
 		ctl->kmsg = -1;
@@ -1021,6 +1149,41 @@ static int init_kmsg(struct dmesg_control *ctl)
 	return 0;
 }
 
+/*
+ * Parses sequence number from /dev/kmsg, the number is terminated by ',' like
+ * the other fields. The field is skipped if it's not a number.
+ */
+static const char *parse_kmsg_seqnum(const char *str0, const char *end,
+				     int64_t *seqnum)
+{
+	char *p = NULL;
+	uintmax_t num;
+
+	errno = 0;
+	num = strtoumax(str0, &p, 10);
+
+	if (errno || !p || p == str0 || *p != ',' || num > INT64_MAX)
+		return skip_item(str0, end, ",;");
+
+	*seqnum = num;
+	return p + 1;	/* skip separator */
+}
+
+/*
+ * Returns sequence number of the raw /dev/kmsg record or -1. This is cheap
+ * way to skip already seen records without full parse_kmsg_record().
+ */
+static int64_t get_kmsg_seqnum(const char *buf, size_t sz)
+{
+	const char *end = buf + sz;
+	const char *p = skip_item(buf, end, ",;");
+	int64_t seqnum = -1;
+
+	if (p < end && *(p - 1) == ',')
+		parse_kmsg_seqnum(p, end, &seqnum);
+	return seqnum;
+}
+
 /*
  * /dev/kmsg record format:
  *
@@ -1052,7 +1215,7 @@ static int parse_kmsg_record(struct dmesg_control *ctl,
 
 	/* A) priority and facility */
 	if (ctl->fltr_lev || ctl->fltr_fac || ctl->decode ||
-	    ctl->raw || ctl->color)
+	    ctl->raw || ctl->color || ctl->json || ctl->binary)
 		p = parse_faclev(p, &rec->facility, &rec->level);
 	else
 		p = skip_item(p, end, ",");
@@ -1060,7 +1223,7 @@ static int parse_kmsg_record(struct dmesg_control *ctl,
 		goto mesg;
 
 	/* B) sequence number */
-	p = skip_item(p, end, ",;");
+	p = parse_kmsg_seqnum(p, end, &rec->seqnum);
 	if (LAST_KMSG_FIELD(p))
 		goto mesg;
 
@@ -1099,6 +1262,114 @@ mesg:
 	return 0;
 }
 
+/*
+ * The kernel sequence numbers start from zero after reboot, so the cursor
+ * file is composed of "<seqnum> <boot_id>".
+ */
+static void read_boot_id(struct dmesg_control *ctl)
+{
+	FILE *f = fopen(_PATH_PROC_BOOT_ID, "r" UL_CLOEXECSTR);
+
+	if (!f || fscanf(f, "%36s", ctl->boot_id) != 1)
+		*ctl->boot_id = '\0';
+	if (f)
+		fclose(f);
+}
+
+/*
+ * Reads the last seen sequence number from cursor file. Returns -1 if the
+ * file does not exist yet or if it has been written before reboot.
+ */
+static int64_t read_cursor_file(struct dmesg_control *ctl)
+{
+	FILE *f = fopen(ctl->cursor_file, "r" UL_CLOEXECSTR);
+	int64_t seqnum = -1;
+	char boot_id[37];
+
+	read_boot_id(ctl);
+
+	if (!f) {
+		if (errno != ENOENT)
+			err(EXIT_FAILURE, _("cannot open %s"), ctl->cursor_file);
+		return -1;
+	}
+	*boot_id = '\0';
+	if (fscanf(f, "%" SCNd64 " %36s", &seqnum, boot_id) < 1 || seqnum < 0) {
+		warnx(_("%s: invalid cursor, ignore"), ctl->cursor_file);
+		seqnum = -1;
+	} else if (strcmp(boot_id, ctl->boot_id) != 0)
+		seqnum = -1;	/* system has been rebooted */
+
+	fclose(f);
+	return seqnum;
+}
+
+/*
+ * Atomically replaces the cursor file (temporary file in the same
+ * directory + rename()). The file is written only if the sequence number
+ * has been changed, so polling on unchanged buffer does not write anything.
+ */
+static void write_cursor_file(struct dmesg_control *ctl)
+{
+	char *dir, *p, *tmpname = NULL;
+	FILE *f;
+	int fd;
+
+	if (!ctl->cursor_file || ctl->kmsg_last_seq < 0 ||
+	    ctl->kmsg_last_seq == ctl->kmsg_saved_seq)
+		return;
+
+	/* the cursor has to follow already written output */
+	fflush(stdout);
+
+	dir = xstrdup(ctl->cursor_file);
+	p = strrchr(dir, '/');
+	if (!p)
+		strcpy(dir, ".");
+	else
+		*(p == dir ? p + 1 : p) = '\0';
+
+	fd = xmkstemp(&tmpname, dir);
+	if (fd < 0)
+		err(EXIT_FAILURE, _("cannot create temporary file in %s"), dir);
+	f = fdopen(fd, "w");
+	if (!f)
+		err(EXIT_FAILURE, _("cannot open %s"), tmpname);
+
+	fprintf(f, "%" PRId64 " %s\n", ctl->kmsg_last_seq, ctl->boot_id);
+
+	if (fflush(f) != 0 || fsync(fd) != 0 || fclose(f) != 0 ||
+	    rename(tmpname, ctl->cursor_file) != 0) {
+		unlink(tmpname);
+		err(EXIT_FAILURE, _("cannot write %s"), ctl->cursor_file);
+	}
+
+	ctl->kmsg_saved_seq = ctl->kmsg_last_seq;
+	free(tmpname);
+	free(dir);
+}
+
+/*
+ * Waits for new /dev/kmsg records. The output is flushed before we go to
+ * sleep, so all records drained by the previous wakeup are written by one
+ * write() rather than one write() per record.
+ *
+ * Returns 0 if new data are available, -1 on error.
+ */
+static int wait_kmsg(struct dmesg_control *ctl)
+{
+	struct pollfd fds = { .fd = ctl->kmsg, .events = POLLIN };
+
+	fflush(stdout);
+	write_cursor_file(ctl);
+
+	while (poll(&fds, 1, -1) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return fds.revents & POLLIN ? 0 : -1;
+}
+
 /*
  * Note that each read() call for /dev/kmsg returns always one record. It means
  * that we don't have to read whole message buffer before the records parsing.
@@ -1106,6 +1377,9 @@ mesg:
  * So this function does not compose one huge buffer (like read_syslog_buffer())
  * and print_buffer() is unnecessary. All is done in this function.
  *
+ * In --follow mode all available records are drained (until EAGAIN) and then
+ * we wait for the next wakeup.
+ *
  * Returns 0 on success, -1 on error.
  */
 static int read_kmsg(struct dmesg_control *ctl)
@@ -1119,20 +1393,40 @@ static int read_kmsg(struct dmesg_control *ctl)
 	/*
 	 * The very first read() call is done in kmsg_init() where we test
 	 * /dev/kmsg usability. The return code from the initial read() is
-	 * stored in ctl->kmsg_first_read;
+	 * stored in ctl->kmsg_first_read; zero means empty buffer.
 	 */
 	sz = ctl->kmsg_first_read;
 
-	while (sz > 0) {
-		*(ctl->kmsg_buf + sz) = '\0';	/* for debug messages */
+	while (1) {
+		if (sz > 0) {
+			int64_t seqnum = get_kmsg_seqnum(ctl->kmsg_buf, sz);
+
+			if (seqnum >= 0 && ctl->kmsg_last_seq >= 0) {
+				/* already seen by previous dmesg instance */
+				if (seqnum <= ctl->kmsg_last_seq)
+					goto next;
+				if (seqnum > ctl->kmsg_last_seq + 1)
+					warnx(_("%" PRId64 " messages lost"),
+					      seqnum - ctl->kmsg_last_seq - 1);
+			}
+			if (seqnum >= 0)
+				ctl->kmsg_last_seq = seqnum;
 
-		if (parse_kmsg_record(ctl, &rec,
-				      ctl->kmsg_buf, (size_t) sz) == 0)
-			print_record(ctl, &rec);
+			*(ctl->kmsg_buf + sz) = '\0';	/* for debug messages */
 
+			if (parse_kmsg_record(ctl, &rec,
+					      ctl->kmsg_buf, (size_t) sz) == 0)
+				print_record(ctl, &rec);
+
+		} else if (sz < 0 && errno != EAGAIN)
+			break;
+		else if (!ctl->follow || wait_kmsg(ctl) != 0)
+			break;
+next:
 		sz = read_kmsg_one(ctl);
 	}
 
+	write_cursor_file(ctl);
 	return 0;
 }
 
@@ -1148,9 +1442,19 @@ int main(int argc, char *argv[])
 		.action = SYSLOG_ACTION_READ_ALL,
 		.method = DMESG_METHOD_KMSG,
 		.kmsg = -1,
+		.kmsg_last_seq = -1,
+		.kmsg_saved_seq = -1,
+	};
+	int64_t since_seq = -1;
+
+	enum {
+		OPT_BINARY = CHAR_MAX + 1,
+		OPT_SINCE_SEQ,
+		OPT_CURSOR_FILE
 	};
 
 	static const struct option longopts[] = {
+		{ "binary",        no_argument,       NULL, OPT_BINARY },
 		{ "buffer-size",   required_argument, NULL, 's' },
 		{ "clear",         no_argument,	      NULL, 'C' },
 		{ "color",         no_argument,	      NULL, 'L' },
@@ -1163,6 +1467,7 @@ int main(int argc, char *argv[])
 		{ "follow",        no_argument,       NULL, 'w' },
 		{ "human",         no_argument,       NULL, 'H' },
 		{ "help",          no_argument,	      NULL, 'h' },
+		{ "json",          no_argument,       NULL, 'J' },
 		{ "kernel",        no_argument,       NULL, 'k' },
 		{ "level",         required_argument, NULL, 'l' },
 		{ "syslog",        no_argument,       NULL, 'S' },
@@ -1171,6 +1476,8 @@ int main(int argc, char *argv[])
 		{ "reltime",       no_argument,       NULL, 'e' },
 		{ "show-delta",    no_argument,	      NULL, 'd' },
 		{ "ctime",         no_argument,       NULL, 'T' },
+		{ "since-seq",     required_argument, NULL, OPT_SINCE_SEQ },
+		{ "cursor-file",   required_argument, NULL, OPT_CURSOR_FILE },
 		{ "notime",        no_argument,       NULL, 't' },
 		{ "nopager",       no_argument,       NULL, 'P' },
 		{ "userspace",     no_argument,       NULL, 'u' },
@@ -1181,6 +1488,7 @@ int main(int argc, char *argv[])
 	static const ul_excl_t excl[] = {	/* rows and cols in in ASCII order */
 		{ 'C','D','E','c','n' },	/* clear,off,on,read-clear,level*/
 		{ 'H','r' },			/* human, raw */
+		{ 'J', OPT_BINARY },		/* json, binary */
 		{ 'L','r' },			/* color, raw */
 		{ 'S','w' },			/* syslog,follow */
 		{ 0 }
@@ -1192,7 +1500,7 @@ int main(int argc, char *argv[])
 	textdomain(PACKAGE);
 	atexit(close_stdout);
 
-	while ((c = getopt_long(argc, argv, "CcDdEeF:f:HhkLl:n:iPrSs:TtuVwx",
+	while ((c = getopt_long(argc, argv, "CcDdEeF:f:HhJkLl:n:iPrSs:TtuVwx",
 				longopts, NULL)) != -1) {
 
 		err_exclusive_options(c, longopts, excl, excl_st);
@@ -1234,6 +1542,9 @@ int main(int argc, char *argv[])
 		case 'h':
 			usage(stdout);
 			break;
+		case 'J':
+			ctl.json = 1;
+			break;
 		case 'k':
 			ctl.fltr_fac = 1;
 			setbit(ctl.facilities, FAC_BASE(LOG_KERN));
@@ -1289,6 +1600,18 @@ int main(int argc, char *argv[])
 		case 'x':
 			ctl.decode = 1;
 			break;
+		case OPT_BINARY:
+			ctl.binary = 1;
+			break;
+		case OPT_SINCE_SEQ:
+			since_seq = strtos64_or_err(optarg,
+					_("invalid sequence number argument"));
+			if (since_seq < 0)
+				errx(EXIT_FAILURE, _("invalid sequence number argument"));
+			break;
+		case OPT_CURSOR_FILE:
+			ctl.cursor_file = optarg;
+			break;
 		case '?':
 		default:
 			usage(stderr);
@@ -1305,6 +1628,18 @@ int main(int argc, char *argv[])
 		errx(EXIT_FAILURE, _("--raw can't be used together with level, "
 		     "facility, decode, delta, ctime or notime options"));
 
+	if ((ctl.json || ctl.binary) && (ctl.raw || ctl.delta || ctl.notime ||
+			ctl.ctime || ctl.reltime || ctl.decode || ctl.color))
+		errx(EXIT_FAILURE, _("--json and --binary can't be used together with raw, "
+		     "delta, notime, ctime, reltime, decode or color options"));
+
+	if (ctl.cursor_file) {
+		ctl.kmsg_saved_seq = read_cursor_file(&ctl);
+		ctl.kmsg_last_seq = ctl.kmsg_saved_seq;
+	}
+	if (since_seq >= 0)
+		ctl.kmsg_last_seq = since_seq;
+
 	if (ctl.notime && (ctl.ctime || ctl.reltime))
 		errx(EXIT_FAILURE, _("--notime can't be used together with --ctime or --reltime"));
 	if (ctl.reltime && ctl.ctime)
@@ -1327,6 +1662,10 @@ int main(int argc, char *argv[])
 	case SYSLOG_ACTION_READ_CLEAR:
 		if (ctl.method == DMESG_METHOD_KMSG && init_kmsg(&ctl) != 0)
 			ctl.method = DMESG_METHOD_SYSLOG;
+		if (ctl.method != DMESG_METHOD_KMSG &&
+		    (since_seq >= 0 || ctl.cursor_file))
+			errx(EXIT_FAILURE, _("--since-seq and --cursor-file are "
+					     "supported for /dev/kmsg only"));
 		if (ctl.pager)
 			setup_pager();
 		n = read_buffer(&ctl, &buf);
@@ -33,6 +33,7 @@ enum {
 	A_SHOW_ONE,		/* print info about one device */
 	A_FIND_FREE,		/* find first unused */
 	A_SET_CAPACITY,		/* set device capacity */
+	A_BATCH,		/* attach/detach devices from file */
 };
 
 enum {
@@ -156,30 +157,78 @@ static int printf_loopdev(struct loopdev_cxt *lc)
 	return 0;
 }
 
-static int show_all_loops(struct loopdev_cxt *lc, const char *file,
-			  uint64_t offset, int flags)
+static int cmp_snapents(const void *a, const void *b)
 {
+	const struct loopdev_snapent *x = *(struct loopdev_snapent **) a,
+				     *y = *(struct loopdev_snapent **) b;
+
+	/* snapshot entries are sorted by devno */
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Returns NULL terminated array of the loop devices associated with @file (or
+ * with canonicalized @file) sorted by devno. The devices are searched in the
+ * loop devices snapshot @sn.
+ */
+static struct loopdev_snapent **get_associated_loops(
+			struct loopdev_snapshot *sn, const char *file,
+			uint64_t offset, int flags)
+{
+	struct loopdev_snapent **res, *ent;
 	struct stat sbuf, *st = &sbuf;
+	char *canonized;
+	size_t i, n = 0;
 
-	if (loopcxt_init_iterator(lc, LOOPITER_FL_USED))
-		return -1;
+	res = xcalloc(sn->nents + 1, sizeof(struct loopdev_snapent *));
 
-	if (!file || stat(file, st))
+	if (stat(file, st))
 		st = NULL;
 
-	while (loopcxt_next(lc) == 0) {
-		if (file && !loopcxt_is_used(lc, st, file, offset, flags)) {
-			char *canonized;
-			int ret;
-			canonized = canonicalize_path(file);
-			ret = loopcxt_is_used(lc, st, canonized, offset, flags);
-			free(canonized);
-			if (!ret)
-				continue;
-		}
-		printf_loopdev(lc);
+	for (i = 0; (ent = loopdev_snapshot_find_by_backing_file(sn,
+				st, file, offset, flags, i)); i++)
+		res[n++] = ent;
+
+	canonized = canonicalize_path(file);
+	for (i = 0; canonized && (ent = loopdev_snapshot_find_by_backing_file(sn,
+				st, canonized, offset, flags, i)); i++) {
+		if (!loopdev_snapent_is_used(ent, st, file, offset, flags))
+			res[n++] = ent;
 	}
-	loopcxt_deinit_iterator(lc);
+	free(canonized);
+
+	qsort(res, n, sizeof(struct loopdev_snapent *), cmp_snapents);
+	return res;
+}
+
+static int show_all_loops(struct loopdev_cxt *lc, const char *file,
+			  uint64_t offset, int flags)
+{
+	struct loopdev_snapshot *sn;
+	struct loopdev_snapent **ents;
+	size_t i;
+
+	if (!file) {
+		if (loopcxt_init_iterator(lc, LOOPITER_FL_USED))
+			return -1;
+		while (loopcxt_next(lc) == 0)
+			printf_loopdev(lc);
+		loopcxt_deinit_iterator(lc);
+		return 0;
+	}
+
+	sn = loopdev_new_snapshot();
+	if (!sn)
+		return -1;
+
+	ents = get_associated_loops(sn, file, offset, flags);
+	for (i = 0; ents[i]; i++) {
+		if (loopcxt_set_device(lc, ents[i]->device) == 0)
+			printf_loopdev(lc);
+	}
+
+	free(ents);
+	loopdev_free_snapshot(sn);
 	return 0;
 }
 
@@ -207,6 +256,241 @@ static int delete_all_loops(struct loopdev_cxt *lc)
 	return res;
 }
 
+/*
+ * --batch file item, the file format is:
+ *
+ *	attach <file> [offset=<num>] [sizelimit=<num>] [ro] [partscan]
+ *	detach <loopdev>|<file>
+ */
+struct batch_item {
+	size_t		lineno;
+	int		action;		/* A_{CREATE,DELETE} */
+	char		*name;		/* backing file or loop device */
+	uint64_t	offset;
+	uint64_t	sizelimit;
+	int		flags;		/* LOOPDEV_FL_{OFFSET,SIZELIMIT} */
+	int		lo_flags;	/* LO_FLAGS_{READ_ONLY,PARTSCAN} */
+};
+
+/*
+ * @def is the default for attach items, from the command line options
+ */
+static struct batch_item *read_batch(const char *filename,
+				     const struct batch_item *def,
+				     size_t *nitems)
+{
+	struct batch_item *items = NULL;
+	size_t n = 0, lineno = 0;
+	char buf[BUFSIZ];
+	FILE *f;
+
+	if (strcmp(filename, "-") == 0)
+		f = stdin;
+	else if (!(f = fopen(filename, "r" UL_CLOEXECSTR)))
+		err(EXIT_FAILURE, _("cannot open %s"), filename);
+
+	while (fgets(buf, sizeof(buf), f)) {
+		struct batch_item *it;
+		char *tok, *save = NULL;
+
+		lineno++;
+		tok = strtok_r(buf, " \t\n", &save);
+		if (!tok || *tok == '#')
+			continue;
+
+		items = xrealloc(items, (n + 1) * sizeof(*items));
+		it = &items[n++];
+		memset(it, 0, sizeof(*it));
+
+		if (strcmp(tok, "attach") == 0) {
+			*it = *def;
+			it->action = A_CREATE;
+		} else if (strcmp(tok, "detach") == 0)
+			it->action = A_DELETE;
+		else
+			errx(EXIT_FAILURE, _("%s:%zu: unknown action '%s'"),
+					filename, lineno, tok);
+		it->lineno = lineno;
+
+		tok = strtok_r(NULL, " \t\n", &save);
+		if (!tok)
+			errx(EXIT_FAILURE, _("%s:%zu: no file or device specified"),
+					filename, lineno);
+		it->name = xstrdup(tok);
+
+		while ((tok = strtok_r(NULL, " \t\n", &save))) {
+			uintmax_t num;
+
+			if (it->action != A_CREATE)
+				errx(EXIT_FAILURE, _("%s:%zu: unexpected '%s'"),
+					filename, lineno, tok);
+			if (strncmp(tok, "offset=", 7) == 0 &&
+			    strtosize(tok + 7, &num) == 0) {
+				it->offset = num;
+				it->flags |= LOOPDEV_FL_OFFSET;
+			} else if (strncmp(tok, "sizelimit=", 10) == 0 &&
+				 strtosize(tok + 10, &num) == 0) {
+				it->sizelimit = num;
+				it->flags |= LOOPDEV_FL_SIZELIMIT;
+			} else if (strcmp(tok, "ro") == 0)
+				it->lo_flags |= LO_FLAGS_READ_ONLY;
+			else if (strcmp(tok, "partscan") == 0)
+				it->lo_flags |= LO_FLAGS_PARTSCAN;
+			else
+				errx(EXIT_FAILURE, _("%s:%zu: unknown option '%s'"),
+					filename, lineno, tok);
+		}
+	}
+
+	if (f != stdin)
+		fclose(f);
+	*nitems = n;
+	return items;
+}
+
+/* prints result of the batch item in NAME="value" format */
+static void report_batch_item(struct batch_item *it, const char *device,
+			      const char *file, int rc)
+{
+	printf("LINE=\"%zu\" ACTION=\"%s\" DEVICE=", it->lineno,
+			it->action == A_CREATE ? "attach" : "detach");
+	tt_fputs_quoted(device, stdout);
+	fputs(" FILE=", stdout);
+	tt_fputs_quoted(file, stdout);
+	printf(" STATUS=\"%s\" ERROR=", rc ? "failed" : "ok");
+	tt_fputs_quoted(rc ? strerror(-rc) : NULL, stdout);
+	fputc('\n', stdout);
+}
+
+static int batch_attach(struct loopdev_cxt *lc, struct loopdev_batch *bt,
+			struct batch_item *it)
+{
+	int rc;
+
+	/* don't get (and maybe allocate) a device for a missing file */
+	if (access(it->name, F_OK) != 0) {
+		rc = -errno;
+		report_batch_item(it, NULL, it->name, rc);
+		return rc;
+	}
+
+	do {
+		/* Note that loopcxt_find_unused_batch() resets loopcxt */
+		rc = loopcxt_find_unused_batch(lc, bt);
+		if (rc)
+			break;
+		if (it->flags & LOOPDEV_FL_OFFSET)
+			loopcxt_set_offset(lc, it->offset);
+		if (it->flags & LOOPDEV_FL_SIZELIMIT)
+			loopcxt_set_sizelimit(lc, it->sizelimit);
+		if (it->lo_flags)
+			loopcxt_set_flags(lc, it->lo_flags);
+		rc = loopcxt_set_backing_file(lc, it->name);
+		if (rc)
+			break;
+		rc = loopcxt_setup_device(lc);
+	} while (rc == -EBUSY);		/* device stolen, try the next one */
+
+	if (rc == -1 && errno)
+		rc = -errno;		/* LOOP_SET_STATUS64 failed */
+	else if (rc > 0)
+		rc = -ENXIO;		/* no free device */
+	report_batch_item(it, rc ? NULL : loopcxt_get_device(lc), it->name, rc);
+	return rc;
+}
+
+static int batch_detach(struct loopdev_cxt *lc, struct loopdev_snapshot **sn,
+			struct batch_item *it)
+{
+	struct loopdev_snapent **ents;
+	int rc = 0;
+	size_t i, n;
+
+	if (is_loopdev(it->name)) {
+		rc = loopcxt_set_device(lc, it->name);
+		if (!rc)
+			rc = loopcxt_get_fd(lc) < 0 ? -errno :
+			     loopcxt_delete_device(lc);
+		report_batch_item(it, it->name, NULL, rc);
+		return rc;
+	}
+
+	/* backing file; the snapshot is read only once for all detach items */
+	if (!*sn && !(*sn = loopdev_new_snapshot())) {
+		report_batch_item(it, NULL, it->name, -ENOMEM);
+		return -ENOMEM;
+	}
+
+	ents = get_associated_loops(*sn, it->name, 0, 0);
+	for (i = 0, n = 0; ents[i]; i++) {
+		/* skip devices detached since the snapshot has been read */
+		if (sysfs_devno_has_attribute(ents[i]->devno, "loop/backing_file"))
+			ents[n++] = ents[i];
+	}
+	ents[n] = NULL;
+
+	if (!ents[0]) {
+		report_batch_item(it, NULL, it->name, -ENXIO);
+		rc = -ENXIO;
+	}
+	for (i = 0; ents[i]; i++) {
+		int res = loopcxt_set_device(lc, ents[i]->device);
+
+		if (!res)
+			res = loopcxt_get_fd(lc) < 0 ? -errno :
+			      loopcxt_delete_device(lc);
+		report_batch_item(it, ents[i]->device, it->name, res);
+		if (res)
+			rc = res;
+	}
+	free(ents);
+	return rc;
+}
+
+/*
+ * Attaches and detaches all devices from the batch @filename. The
+ * /dev/loop-control is open only once and free devices for all attach items
+ * are found by one scan.
+ */
+static int run_batch(struct loopdev_cxt *lc, const char *filename,
+		     const struct batch_item *def)
+{
+	struct loopdev_snapshot *sn = NULL;
+	struct loopdev_batch bt;
+	struct batch_item *items;
+	size_t i, nitems = 0, nattach = 0;
+	int nfails = 0;
+
+	items = read_batch(filename, def, &nitems);
+
+	for (i = 0; i < nitems; i++) {
+		if (items[i].action == A_CREATE)
+			nattach++;
+	}
+	if (loopdev_init_batch(&bt, nattach))
+		err(EXIT_FAILURE, _("failed to initialize loop devices pool"));
+
+	for (i = 0; i < nitems; i++) {
+		struct batch_item *it = &items[i];
+
+		if (it->action == A_CREATE) {
+			if (batch_attach(lc, &bt, it))
+				nfails++;
+			/* the new device has to be visible for detach items */
+			loopdev_free_snapshot(sn);
+			sn = NULL;
+		} else if (batch_detach(lc, &sn, it))
+			nfails++;
+
+		free(it->name);
+	}
+
+	loopdev_free_snapshot(sn);
+	loopdev_deinit_batch(&bt);
+	free(items);
+	return nfails;
+}
+
 static int set_tt_data(struct loopdev_cxt *lc, struct tt_line *ln)
 {
 	int i;
@@ -293,7 +577,6 @@ static int set_tt_data(struct loopdev_cxt *lc, struct tt_line *ln)
 static int make_table(struct loopdev_cxt *lc, const char *file,
 		uint64_t offset, int flags)
 {
-	struct stat sbuf, *st = &sbuf;
 	struct tt_line *ln;
 	int i;
 
@@ -314,16 +597,32 @@ static int make_table(struct loopdev_cxt *lc, const char *file,
 		return 0;
 	}
 
+	if (file) {
+		struct loopdev_snapshot *sn = loopdev_new_snapshot();
+		struct loopdev_snapent **ents;
+		int rc = 0;
+
+		if (!sn)
+			return -1;
+
+		ents = get_associated_loops(sn, file, offset, flags);
+		for (i = 0; rc == 0 && ents[i]; i++) {
+			if (loopcxt_set_device(lc, ents[i]->device))
+				continue;
+			ln = tt_add_line(tt, NULL);
+			if (set_tt_data(lc, ln))
+				rc = -EINVAL;
+		}
+
+		free(ents);
+		loopdev_free_snapshot(sn);
+		return rc;
+	}
+
 	if (loopcxt_init_iterator(lc, LOOPITER_FL_USED))
 		return -1;
-	if (!file || stat(file, st))
-		st = NULL;
 
 	while (loopcxt_next(lc) == 0) {
-		if (file && !loopcxt_is_used(lc, st, file, offset, flags))
-			continue;
-
-
 		ln = tt_add_line(tt, NULL);
 		if (set_tt_data(lc, ln))
 			return -EINVAL;
@@ -350,7 +649,8 @@ static void usage(FILE *out)
 		" -D, --detach-all              detach all used devices\n"
 		" -f, --find                    find first unused device\n"
 		" -c, --set-capacity <loopdev>  resize device\n"
-		" -j, --associated <file>       list all devices associated with <file>\n"), out);
+		" -j, --associated <file>       list all devices associated with <file>\n"
+		"     --batch <file>            attach or detach devices listed in <file>\n"), out);
 	fputs(USAGE_SEPARATOR, out);
 
 	fputs(_(" -l, --list                    list info about all or specified\n"), out);
@@ -407,10 +707,12 @@ int main(int argc, char **argv)
 
 	enum {
 		OPT_SIZELIMIT = CHAR_MAX + 1,
-		OPT_SHOW
+		OPT_SHOW,
+		OPT_BATCH
 	};
 	static const struct option longopts[] = {
 		{ "all", 0, 0, 'a' },
+		{ "batch", 1, 0, OPT_BATCH },
 		{ "set-capacity", 1, 0, 'c' },
 		{ "detach", 1, 0, 'd' },
 		{ "detach-all", 0, 0, 'D' },
@@ -432,9 +734,10 @@ int main(int argc, char **argv)
 	};
 
 	static const ul_excl_t excl[] = {	/* rows and cols in ASCII order */
-		{ 'D','a','c','d','f','j' },
-		{ 'D','c','d','f','l' },
-		{ 'D','c','d','f','O' },
+		{ 'D','a','c','d','f','j',OPT_BATCH },
+		{ 'D','c','d','f','l',OPT_BATCH },
+		{ 'D','c','d','f','O',OPT_BATCH },
+		{ OPT_SHOW,OPT_BATCH },
 		{ 0 }
 	};
 	int excl_st[ARRAY_SIZE(excl)] = UL_EXCL_STATUS_INIT;
@@ -508,6 +811,10 @@ int main(int argc, char **argv)
 		case OPT_SHOW:
 			showdev = 1;
 			break;
+		case OPT_BATCH:
+			act = A_BATCH;
+			file = optarg;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -581,14 +888,14 @@ int main(int argc, char **argv)
 		file = argv[optind++];
 	}
 
-	if (act != A_CREATE &&
+	if (act != A_CREATE && act != A_BATCH &&
 	    (sizelimit || lo_flags || showdev))
 		errx(EXIT_FAILURE,
 			_("the options %s are allowed to loop device setup only"),
 			"--{sizelimit,read-only,show}");
 
-	if ((flags & LOOPDEV_FL_OFFSET) &&
-	    act != A_CREATE && (act != A_SHOW || !file))
+	if ((flags & LOOPDEV_FL_OFFSET) && act != A_CREATE && act != A_BATCH &&
+	    (act != A_SHOW || !file))
 		errx(EXIT_FAILURE, _("the option --offset is not allowed in this context."));
 
 	if (outarg && string_add_to_idarray(outarg, columns, ARRAY_SIZE(columns),
@@ -670,6 +977,18 @@ int main(int argc, char **argv)
 		if (res)
 			warn(_("%s"), loopcxt_get_device(&lc));
 		break;
+	case A_BATCH:
+	{
+		/* the setup options are defaults for the attach items */
+		struct batch_item def = {
+			.offset = offset,
+			.sizelimit = sizelimit,
+			.flags = flags,
+			.lo_flags = lo_flags
+		};
+		res = run_batch(&lc, file, &def);
+		break;
+	}
 	case A_SET_CAPACITY:
 		res = loopcxt_set_capacity(&lc);
 		if (res)
@@ -32,6 +32,7 @@
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "cpuset.h"
 #include "nls.h"
@@ -43,6 +44,7 @@
 #include "path.h"
 #include "closestream.h"
 #include "optutils.h"
+#include "all-io.h"
 
 #define CACHE_MAX 100
 
@@ -54,6 +56,10 @@
 #define _PATH_PROC_CPUINFO	"/proc/cpuinfo"
 #define _PATH_PROC_PCIDEVS	"/proc/bus/pci/devices"
 #define _PATH_PROC_SYSINFO	"/proc/sysinfo"
+#define _PATH_PROC_BOOTID	"/proc/sys/kernel/random/boot_id"
+
+/* --cache file header */
+#define LSCPU_CACHE_MAGIC	"# lscpu cache: "
 
 /* virtualization types */
 enum {
@@ -91,6 +97,12 @@ enum {
 	MODE_64BIT	= (1 << 2)
 };
 
+/* hash of unique CPU masks in an array, see add_cpuset_to_array() */
+struct cpuset_hash {
+	size_t		size;		/* number of slots, power of 2 */
+	int		*slots;		/* index in the array + 1, 0 = unused */
+};
+
 /* cache(s) description */
 struct cpu_cache {
 	char		*name;
@@ -98,6 +110,8 @@ struct cpu_cache {
 
 	int		nsharedmaps;
 	cpu_set_t	**sharedmaps;
+	struct cpuset_hash sharedhash;
+	int		*sharedids;	/* CPU -> index in sharedmaps */
 };
 
 /* dispatching modes */
@@ -163,16 +177,22 @@ struct lscpu_desc {
 	 * hardware threads within the same book */
 	int		nbooks;		/* number of all online books */
 	cpu_set_t	**bookmaps;	/* unique book_siblings */
+	struct cpuset_hash bookhash;
+	int		*bookids;	/* CPU -> index in bookmaps */
 
 	/* sockets -- based on core_siblings (internal kernel map of cpuX's
 	 * hardware threads within the same physical_package_id (socket)) */
 	int		nsockets;	/* number of all online sockets */
 	cpu_set_t	**socketmaps;	/* unique core_siblings */
+	struct cpuset_hash sockethash;
+	int		*socketids;	/* CPU -> index in socketmaps */
 
 	/* cores -- based on thread_siblings (internel kernel map of cpuX's
 	 * hardware threads within the same core as cpuX) */
 	int		ncores;		/* number of all online cores */
 	cpu_set_t	**coremaps;	/* unique thread_siblings */
+	struct cpuset_hash corehash;
+	int		*coreids;	/* CPU -> index in coremaps */
 
 	int		nthreads;	/* number of online threads */
 
@@ -593,26 +613,86 @@ read_hypervisor(struct lscpu_desc *desc, struct lscpu_modifier *mod)
 	}
 }
 
-/* add @set to the @ary, unnecessary set is deallocated. */
-static int add_cpuset_to_array(cpu_set_t **ary, int *items, cpu_set_t *set)
+static size_t cpuset_hashfn(cpu_set_t *set, size_t setsize)
+{
+	const unsigned long *p = (const unsigned long *) set;
+	size_t i, h = 0;
+
+	for (i = 0; i < setsize / sizeof(unsigned long); i++)
+		h = (h ^ p[i]) * 0x9E3779B1UL;
+	return h ^ (h >> 16);
+}
+
+/*
+ * Add @set to the @ary, unnecessary set is deallocated. The @hash is used to
+ * find already existing sets, it has to be big enough for @maxitems.
+ *
+ * Returns index of the set in the array.
+ */
+static int add_cpuset_to_array(cpu_set_t **ary, int *items, int maxitems,
+			       struct cpuset_hash *hash, cpu_set_t *set)
 {
-	int i;
 	size_t setsize = CPU_ALLOC_SIZE(maxcpus);
+	size_t i;
 
 	if (!ary)
 		return -1;
 
-	for (i = 0; i < *items; i++) {
-		if (CPU_EQUAL_S(setsize, set, ary[i]))
-			break;
+	if (!hash->slots) {
+		for (hash->size = 16; hash->size < (size_t) maxitems * 2; )
+			hash->size <<= 1;
+		hash->slots = xcalloc(hash->size, sizeof(int));
 	}
-	if (i == *items) {
-		ary[*items] = set;
-		++*items;
-		return 0;
+
+	for (i = cpuset_hashfn(set, setsize) & (hash->size - 1);
+	     hash->slots[i];
+	     i = (i + 1) & (hash->size - 1)) {
+
+		int idx = hash->slots[i] - 1;
+
+		if (CPU_EQUAL_S(setsize, set, ary[idx])) {
+			CPU_FREE(set);
+			return idx;
+		}
 	}
-	CPU_FREE(set);
-	return 1;
+
+	if (*items >= maxitems) {
+		CPU_FREE(set);
+		return -1;
+	}
+	ary[*items] = set;
+	hash->slots[i] = ++*items;
+	return *items - 1;
+}
+
+/*
+ * Returns index of the map with @cpu. The @ids is filled when the maps are
+ * read, but CPUs without topology in sysfs (e.g. offline) may be still
+ * found in masks read for other CPUs.
+ */
+static int
+cpu_to_mapidx(int cpu, int *ids, cpu_set_t **maps, int nmaps)
+{
+	size_t idx;
+
+	if (!ids)
+		return -1;
+	if (ids[cpu] >= 0)
+		return ids[cpu];
+	if (cpuset_ary_isset(cpu, maps, nmaps,
+			     CPU_ALLOC_SIZE(maxcpus), &idx) == 0)
+		return idx;
+	return -1;
+}
+
+/* returns array for CPU -> map index translation */
+static int *alloc_ids(int n)
+{
+	int *ids = xmalloc(n * sizeof(int));
+
+	while (n > 0)
+		ids[--n] = -1;
+	return ids;
 }
 
 static void
@@ -620,18 +700,14 @@ read_topology(struct lscpu_desc *desc, int num)
 {
 	cpu_set_t *thread_siblings, *core_siblings, *book_siblings;
 
-	if (!path_exist(_PATH_SYS_CPU "/cpu%d/topology/thread_siblings", num))
-		return;
-
-	thread_siblings = path_read_cpuset(maxcpus, _PATH_SYS_CPU
+	thread_siblings = path_try_read_cpuset(maxcpus, _PATH_SYS_CPU
 					"/cpu%d/topology/thread_siblings", num);
+	if (!thread_siblings)
+		return;
 	core_siblings = path_read_cpuset(maxcpus, _PATH_SYS_CPU
 					"/cpu%d/topology/core_siblings", num);
-	book_siblings = NULL;
-	if (path_exist(_PATH_SYS_CPU "/cpu%d/topology/book_siblings", num)) {
-		book_siblings = path_read_cpuset(maxcpus, _PATH_SYS_CPU
-					    "/cpu%d/topology/book_siblings", num);
-	}
+	book_siblings = path_try_read_cpuset(maxcpus, _PATH_SYS_CPU
+					"/cpu%d/topology/book_siblings", num);
 
 	if (!desc->coremaps) {
 		int nbooks, nsockets, ncores, nthreads;
@@ -675,14 +751,26 @@ read_topology(struct lscpu_desc *desc, int num)
 		 */
 		desc->coremaps = xcalloc(desc->ncpuspos, sizeof(cpu_set_t *));
 		desc->socketmaps = xcalloc(desc->ncpuspos, sizeof(cpu_set_t *));
-		if (book_siblings)
+		desc->coreids = alloc_ids(desc->ncpuspos);
+		desc->socketids = alloc_ids(desc->ncpuspos);
+		if (book_siblings) {
 			desc->bookmaps = xcalloc(desc->ncpuspos, sizeof(cpu_set_t *));
+			desc->bookids = alloc_ids(desc->ncpuspos);
+		}
 	}
 
-	add_cpuset_to_array(desc->socketmaps, &desc->nsockets, core_siblings);
-	add_cpuset_to_array(desc->coremaps, &desc->ncores, thread_siblings);
-	if (book_siblings)
-		add_cpuset_to_array(desc->bookmaps, &desc->nbooks, book_siblings);
+	desc->socketids[num] = add_cpuset_to_array(desc->socketmaps,
+				&desc->nsockets, desc->ncpuspos,
+				&desc->sockethash, core_siblings);
+	desc->coreids[num] = add_cpuset_to_array(desc->coremaps,
+				&desc->ncores, desc->ncpuspos,
+				&desc->corehash, thread_siblings);
+	if (book_siblings && desc->bookmaps)
+		desc->bookids[num] = add_cpuset_to_array(desc->bookmaps,
+				&desc->nbooks, desc->ncpuspos,
+				&desc->bookhash, book_siblings);
+	else if (book_siblings)
+		CPU_FREE(book_siblings);
 }
 static void
 read_polarization(struct lscpu_desc *desc, int num)
@@ -691,11 +779,11 @@ read_polarization(struct lscpu_desc *desc, int num)
 
 	if (desc->dispatching < 0)
 		return;
-	if (!path_exist(_PATH_SYS_CPU "/cpu%d/polarization", num))
+	if (path_try_read_str(mode, sizeof(mode),
+			      _PATH_SYS_CPU "/cpu%d/polarization", num))
 		return;
 	if (!desc->polarization)
 		desc->polarization = xcalloc(desc->ncpuspos, sizeof(int));
-	path_read_str(mode, sizeof(mode), _PATH_SYS_CPU "/cpu%d/polarization", num);
 	if (strncmp(mode, "vertical:low", sizeof(mode)) == 0)
 		desc->polarization[num] = POLAR_VLOW;
 	else if (strncmp(mode, "vertical:medium", sizeof(mode)) == 0)
@@ -711,21 +799,25 @@ read_polarization(struct lscpu_desc *desc, int num)
 static void
 read_address(struct lscpu_desc *desc, int num)
 {
-	if (!path_exist(_PATH_SYS_CPU "/cpu%d/address", num))
+	int addr;
+
+	if (path_try_read_s32(&addr, _PATH_SYS_CPU "/cpu%d/address", num))
 		return;
 	if (!desc->addresses)
 		desc->addresses = xcalloc(desc->ncpuspos, sizeof(int));
-	desc->addresses[num] = path_read_s32(_PATH_SYS_CPU "/cpu%d/address", num);
+	desc->addresses[num] = addr;
 }
 
 static void
 read_configured(struct lscpu_desc *desc, int num)
 {
-	if (!path_exist(_PATH_SYS_CPU "/cpu%d/configure", num))
+	int conf;
+
+	if (path_try_read_s32(&conf, _PATH_SYS_CPU "/cpu%d/configure", num))
 		return;
 	if (!desc->configured)
 		desc->configured = xcalloc(desc->ncpuspos, sizeof(int));
-	desc->configured[num] = path_read_s32(_PATH_SYS_CPU "/cpu%d/configure", num);
+	desc->configured[num] = conf;
 }
 
 static int
@@ -757,8 +849,11 @@ read_cache(struct lscpu_desc *desc, int num)
 		struct cpu_cache *ca = &desc->caches[i];
 		cpu_set_t *map;
 
-		if (!path_exist(_PATH_SYS_SYSTEM "/cpu/cpu%d/cache/index%d",
-				num, i))
+		/* information about how CPUs share different caches */
+		map = path_try_read_cpuset(maxcpus,
+				  _PATH_SYS_CPU "/cpu%d/cache/index%d/shared_cpu_map",
+				  num, i);
+		if (!map)
 			continue;
 		if (!ca->name) {
 			int type, level;
@@ -791,14 +886,13 @@ read_cache(struct lscpu_desc *desc, int num)
 			ca->size = xstrdup(buf);
 		}
 
-		/* information about how CPUs share different caches */
-		map = path_read_cpuset(maxcpus,
-				  _PATH_SYS_CPU "/cpu%d/cache/index%d/shared_cpu_map",
-				  num, i);
-
-		if (!ca->sharedmaps)
+		if (!ca->sharedmaps) {
 			ca->sharedmaps = xcalloc(desc->ncpuspos, sizeof(cpu_set_t *));
-		add_cpuset_to_array(ca->sharedmaps, &ca->nsharedmaps, map);
+			ca->sharedids = alloc_ids(desc->ncpuspos);
+		}
+		ca->sharedids[num] = add_cpuset_to_array(ca->sharedmaps,
+					&ca->nsharedmaps, desc->ncpuspos,
+					&ca->sharedhash, map);
 	}
 }
 
@@ -830,6 +924,7 @@ get_cell_data(struct lscpu_desc *desc, int cpu, int col,
 {
 	size_t setsize = CPU_ALLOC_SIZE(maxcpus);
 	size_t idx;
+	int i;
 
 	*buf = '\0';
 
@@ -838,14 +933,16 @@ get_cell_data(struct lscpu_desc *desc, int cpu, int col,
 		snprintf(buf, bufsz, "%d", cpu);
 		break;
 	case COL_CORE:
-		if (cpuset_ary_isset(cpu, desc->coremaps,
-				     desc->ncores, setsize, &idx) == 0)
-			snprintf(buf, bufsz, "%zd", idx);
+		i = cpu_to_mapidx(cpu, desc->coreids,
+				  desc->coremaps, desc->ncores);
+		if (i >= 0)
+			snprintf(buf, bufsz, "%d", i);
 		break;
 	case COL_SOCKET:
-		if (cpuset_ary_isset(cpu, desc->socketmaps,
-				     desc->nsockets, setsize, &idx) == 0)
-			snprintf(buf, bufsz, "%zd", idx);
+		i = cpu_to_mapidx(cpu, desc->socketids,
+				  desc->socketmaps, desc->nsockets);
+		if (i >= 0)
+			snprintf(buf, bufsz, "%d", i);
 		break;
 	case COL_NODE:
 		if (cpuset_ary_isset(cpu, desc->nodemaps,
@@ -853,9 +950,10 @@ get_cell_data(struct lscpu_desc *desc, int cpu, int col,
 			snprintf(buf, bufsz, "%zd", idx);
 		break;
 	case COL_BOOK:
-		if (cpuset_ary_isset(cpu, desc->bookmaps,
-				     desc->nbooks, setsize, &idx) == 0)
-			snprintf(buf, bufsz, "%zd", idx);
+		i = cpu_to_mapidx(cpu, desc->bookids,
+				  desc->bookmaps, desc->nbooks);
+		if (i >= 0)
+			snprintf(buf, bufsz, "%d", i);
 		break;
 	case COL_CACHE:
 	{
@@ -866,9 +964,10 @@ get_cell_data(struct lscpu_desc *desc, int cpu, int col,
 		for (j = desc->ncaches - 1; j >= 0; j--) {
 			struct cpu_cache *ca = &desc->caches[j];
 
-			if (cpuset_ary_isset(cpu, ca->sharedmaps,
-					     ca->nsharedmaps, setsize, &idx) == 0) {
-				int x = snprintf(p, sz, "%zd", idx);
+			i = cpu_to_mapidx(cpu, ca->sharedids,
+					  ca->sharedmaps, ca->nsharedmaps);
+			if (i >= 0) {
+				int x = snprintf(p, sz, "%d", i);
 				if (x <= 0 || (size_t) x + 2 >= sz)
 					return NULL;
 				p += x;
@@ -1255,6 +1354,143 @@ print_summary(struct lscpu_desc *desc, struct lscpu_modifier *mod)
 	}
 }
 
+/*
+ * --cache backend. The file contains the header line with a key and the
+ * output. The key describes the current CPUs, the locale and the command
+ * line, the cached output is used only if the key matches.
+ */
+static char *
+cache_key(int argc, char *argv[])
+{
+	char bootid[64], *key, *online, *present;
+	size_t sz = BUFSIZ;
+	int i;
+
+	online = xmalloc(sz);
+	present = xmalloc(sz);
+
+	if (path_try_read_str(bootid, sizeof(bootid), _PATH_PROC_BOOTID))
+		*bootid = '\0';
+	if (path_try_read_str(online, sz, _PATH_SYS_CPU "/online"))
+		*online = '\0';
+	if (path_try_read_str(present, sz, _PATH_SYS_CPU "/present"))
+		*present = '\0';
+
+	/* translations and number formats depend on the locale */
+	xasprintf(&key, "boot=%s online=%s present=%s locale=%s args=",
+		  bootid, online, present, setlocale(LC_ALL, NULL));
+	free(online);
+	free(present);
+
+	for (i = 1; i < argc; i++) {
+		char *tmp;
+
+		xasprintf(&tmp, "%s%s%s", key, i > 1 ? " " : "", argv[i]);
+		free(key);
+		key = tmp;
+	}
+	return key;
+}
+
+/* prints the cached output and returns 0 or returns 1 if not cached */
+static int
+print_cached(const char *filename, const char *key)
+{
+	char *data, *p;
+	struct stat st;
+	size_t keysz = strlen(key);
+	int fd, rc = 1;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &st) || (size_t) st.st_size <
+			      sizeof(LSCPU_CACHE_MAGIC) + keysz) {
+		close(fd);
+		return 1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 1;
+
+	p = data + sizeof(LSCPU_CACHE_MAGIC) - 1;
+	if (memcmp(data, LSCPU_CACHE_MAGIC, sizeof(LSCPU_CACHE_MAGIC) - 1) == 0 &&
+	    memcmp(p, key, keysz) == 0 && *(p + keysz) == '\n') {
+		p += keysz + 1;
+		if (fwrite_all(p, 1, st.st_size - (p - data), stdout) == 0)
+			rc = 0;
+	}
+	munmap(data, st.st_size);
+	return rc;
+}
+
+/*
+ * Redirects stdout to a new temporary cache file, returns the original
+ * stdout file descriptor or -1 on error.
+ */
+static int
+cache_begin(const char *filename, const char *key, char **tmpname)
+{
+	int fd, stdoutfd;
+
+	xasprintf(tmpname, "%s.XXXXXX", filename);
+	fd = mkstemp(*tmpname);
+	if (fd < 0) {
+		warn(_("cannot create %s"), *tmpname);
+		goto err;
+	}
+	if (write_all(fd, LSCPU_CACHE_MAGIC, sizeof(LSCPU_CACHE_MAGIC) - 1) ||
+	    write_all(fd, key, strlen(key)) ||
+	    write_all(fd, "\n", 1)) {
+		warn(_("write failed: %s"), *tmpname);
+		goto err_unlink;
+	}
+
+	fflush(stdout);
+	stdoutfd = dup(STDOUT_FILENO);
+	if (stdoutfd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		warn(_("cannot redirect output to %s"), *tmpname);
+		if (stdoutfd >= 0)
+			close(stdoutfd);
+		goto err_unlink;
+	}
+	close(fd);
+	return stdoutfd;
+
+err_unlink:
+	close(fd);
+	unlink(*tmpname);
+err:
+	free(*tmpname);
+	*tmpname = NULL;
+	return -1;
+}
+
+/*
+ * Restores stdout, prints the new cache file content and replaces
+ * the old cache file.
+ */
+static void
+cache_end(const char *filename, const char *key, char *tmpname, int stdoutfd)
+{
+	int ok = fflush(stdout) == 0 && !ferror(stdout);
+
+	if (dup2(stdoutfd, STDOUT_FILENO) < 0)
+		err(EXIT_FAILURE, _("cannot restore standard output"));
+	close(stdoutfd);
+
+	if (!ok || print_cached(tmpname, key) != 0) {
+		/* never keep incomplete cache */
+		unlink(tmpname);
+		errx(EXIT_FAILURE, _("write failed: %s"), tmpname);
+	}
+	if (rename(tmpname, filename))
+		warn(_("cannot rename %s to %s"), tmpname, filename);
+	free(tmpname);
+}
+
 static void __attribute__((__noreturn__)) usage(FILE *out)
 {
 	size_t i;
@@ -1266,6 +1502,7 @@ static void __attribute__((__noreturn__)) usage(FILE *out)
 	fputs(_(" -a, --all               print both online and offline CPUs (default for -e)\n"), out);
 	fputs(_(" -b, --online            print online CPUs only (default for -p)\n"), out);
 	fputs(_(" -c, --offline           print offline CPUs only\n"), out);
+	fputs(_("     --cache <file>      use output cached in the file, or update it\n"), out);
 	fputs(_(" -e, --extended[=<list>] print out an extended readable format\n"), out);
 	fputs(_(" -p, --parse[=<list>]    print out a parsable format\n"), out);
 	fputs(_(" -s, --sysroot <dir>     use specified directory as system root\n"), out);
@@ -1291,7 +1528,12 @@ int main(int argc, char *argv[])
 	int c, i;
 	int columns[ARRAY_SIZE(coldescs)], ncolumns = 0;
 	int cpu_modifier_specified = 0;
+	char *cachefile = NULL, *cachekey = NULL, *cachetmp = NULL;
+	int stdoutfd = -1;
 
+	enum {
+		OPT_CACHE = CHAR_MAX + 1
+	};
 	static const struct option longopts[] = {
 		{ "all",        no_argument,       0, 'a' },
 		{ "online",     no_argument,       0, 'b' },
@@ -1302,6 +1544,7 @@ int main(int argc, char *argv[])
 		{ "sysroot",	required_argument, 0, 's' },
 		{ "hex",	no_argument,	   0, 'x' },
 		{ "version",	no_argument,	   0, 'V' },
+		{ "cache",	required_argument, 0, OPT_CACHE },
 		{ NULL,		0, 0, 0 }
 	};
 
@@ -1356,6 +1599,9 @@ int main(int argc, char *argv[])
 		case 'x':
 			mod->hex = 1;
 			break;
+		case OPT_CACHE:
+			cachefile = optarg;
+			break;
 		case 'V':
 			printf(_("%s from %s\n"), program_invocation_short_name,
 			       PACKAGE_STRING);
@@ -1382,6 +1628,13 @@ int main(int argc, char *argv[])
 		mod->offline = mod->mode == OUTPUT_READABLE ? 1 : 0;
 	}
 
+	if (cachefile) {
+		cachekey = cache_key(argc, argv);
+		if (print_cached(cachefile, cachekey) == 0)
+			return EXIT_SUCCESS;
+		stdoutfd = cache_begin(cachefile, cachekey, &cachetmp);
+	}
+
 	read_basicinfo(desc, mod);
 
 	for (i = 0; i < desc->ncpuspos; i++) {
@@ -1441,5 +1694,9 @@ int main(int argc, char *argv[])
 		break;
 	}
 
+	if (stdoutfd >= 0)
+		cache_end(cachefile, cachekey, cachetmp, stdoutfd);
+	free(cachekey);
+
 	return EXIT_SUCCESS;
 }
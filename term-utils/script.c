@@ -58,8 +58,11 @@
 #include <limits.h>
 #include <locale.h>
 #include <stddef.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #include "closestream.h"
+#include "all-io.h"
 #include "nls.h"
 #include "c.h"
 
@@ -73,6 +76,11 @@
 
 #define DEFAULT_OUTPUT "typescript"
 
+/* with -f, the longest time output may sit in the buffers while it flows */
+#define FLUSH_INTERVAL	100	/* milliseconds */
+
+#define SCRIPT_BUFSIZ	(64 * 1024)
+
 void finish(int);
 void done(void);
 void fail(void);
@@ -80,16 +88,15 @@ void resize(int);
 void fixtty(void);
 void getmaster(void);
 void getslave(void);
-void doinput(void);
-void dooutput(FILE *timingfd);
+void doio(sigset_t *unblock_mask);
 void doshell(void);
 
 char	*shell;
 FILE	*fscript;
+FILE	*timingfd;
 int	master = -1;
 int	slave;
 pid_t	child;
-pid_t	subchild;
 int	childstatus;
 char	*fname;
 
@@ -109,7 +116,6 @@ int	tflg = 0;
 int	forceflg = 0;
 
 int die;
-int resized;
 
 static void
 die_if_link(char *fn) {
@@ -159,7 +165,6 @@ main(int argc, char **argv) {
 	sigset_t block_mask, unblock_mask;
 	struct sigaction sa;
 	int ch;
-	FILE *timingfd = NULL;
 
 	enum { FORCE_OPTION = CHAR_MAX + 1 };
 
@@ -241,83 +246,44 @@ main(int argc, char **argv) {
 	getmaster();
 	if (!qflg)
 		printf(_("Script started, file is %s\n"), fname);
+	fflush(stdout);
 	fixtty();
 
 #ifdef HAVE_LIBUTEMPTER
 	utempter_add_record(master, NULL);
 #endif
-	/* setup SIGCHLD handler */
+	/* setup SIGCHLD and SIGWINCH handlers */
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
 	sa.sa_handler = finish;
 	sigaction(SIGCHLD, &sa, NULL);
+	sa.sa_handler = resize;
+	sigaction(SIGWINCH, &sa, NULL);
 
-	/* init mask for SIGCHLD */
+	/* the signals are delivered only while waiting in doio() */
 	sigprocmask(SIG_SETMASK, NULL, &block_mask);
 	sigaddset(&block_mask, SIGCHLD);
+	sigaddset(&block_mask, SIGWINCH);
 
 	sigprocmask(SIG_SETMASK, &block_mask, &unblock_mask);
 	child = fork();
-	sigprocmask(SIG_SETMASK, &unblock_mask, NULL);
 
 	if (child < 0) {
 		warn(_("fork failed"));
 		fail();
 	}
 	if (child == 0) {
-
-		sigprocmask(SIG_SETMASK, &block_mask, NULL);
-		subchild = child = fork();
 		sigprocmask(SIG_SETMASK, &unblock_mask, NULL);
-
-		if (child < 0) {
-			warn(_("fork failed"));
-			fail();
-		}
-		if (child) {
-			if (!timingfd)
-				timingfd = fdopen(STDERR_FILENO, "w");
-			dooutput(timingfd);
-		} else
-			doshell();
-	} else {
-		sa.sa_handler = resize;
-		sigaction(SIGWINCH, &sa, NULL);
+		doshell();
 	}
-	doinput();
-
-	if (close_stream(timingfd) != 0)
-		errx(EXIT_FAILURE, _("write error"));
-	return EXIT_SUCCESS;
-}
-
-void
-doinput(void) {
-	ssize_t cc;
-	char ibuf[BUFSIZ];
 
-	if (close_stream(fscript) != 0)
-		errx(EXIT_FAILURE, _("write error"));
+	if (tflg && !timingfd)
+		timingfd = fdopen(STDERR_FILENO, "w");
+	doio(&unblock_mask);
 
-	while (die == 0) {
-		if ((cc = read(STDIN_FILENO, ibuf, BUFSIZ)) > 0) {
-			ssize_t wrt = write(master, ibuf, cc);
-			if (wrt < 0) {
-				warn (_("write failed"));
-				fail();
-			}
-		}
-		else if (cc < 0 && errno == EINTR && resized)
-			resized = 0;
-		else
-			break;
-	}
-
-	done();
+	return EXIT_SUCCESS;
 }
 
-#include <sys/wait.h>
-
 void
 finish(int dummy __attribute__ ((__unused__))) {
 	int status;
@@ -332,10 +298,9 @@ finish(int dummy __attribute__ ((__unused__))) {
 
 void
 resize(int dummy __attribute__ ((__unused__))) {
-	resized = 1;
 	/* transmit window change information to the child */
 	ioctl(STDIN_FILENO, TIOCGWINSZ, (char *)&win);
-	ioctl(slave, TIOCSWINSZ, (char *)&win);
+	ioctl(master, TIOCSWINSZ, (char *)&win);
 }
 
 /*
@@ -347,70 +312,162 @@ my_strftime(char *buf, size_t len, const char *fmt, const struct tm *tm) {
 	strftime(buf, len, fmt, tm);
 }
 
+static long
+msec_since(struct timeval *tv) {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - tv->tv_sec) * 1000
+		+ (now.tv_usec - tv->tv_usec) / 1000;
+}
+
+static void
+flush_output(struct timeval *lastflush) {
+	fflush(fscript);
+	if (timingfd)
+		fflush(timingfd);
+	gettimeofday(lastflush, NULL);
+}
+
+/*
+ * Copy what the shell writes to stdout and to the typescript, and what is
+ * typed to the shell, in one process.  The pty master is non-blocking, so
+ * a shell that does not read its input cannot stop its output from being
+ * read.  With -f, the typescript is flushed at most FLUSH_INTERVAL after
+ * it was written.
+ */
 void
-dooutput(FILE *timingfd) {
-	ssize_t cc;
+doio(sigset_t *unblock_mask) {
+	static char scriptbuf[SCRIPT_BUFSIZ];
+	struct pollfd pfd[2];
+	struct timespec timeout;
+	struct timeval tv, lastflush;
 	time_t tvec;
-	char obuf[BUFSIZ];
-	struct timeval tv;
-	double oldtime=time(NULL), newtime;
-	int flgs = 0;
-	ssize_t wrt;
-	ssize_t fwrt;
-
-	close(STDIN_FILENO);
+	char obuf[BUFSIZ], ibuf[BUFSIZ];
+	size_t ilen = 0, ioff = 0;
+	double oldtime = time(NULL), newtime;
+	int dirty = 0, ineof = 0;
+	ssize_t cc;
+
 #ifdef HAVE_LIBUTIL
 	close(slave);
 #endif
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL, 0) | O_NONBLOCK);
+	setvbuf(fscript, scriptbuf, _IOFBF, sizeof(scriptbuf));
+
 	tvec = time((time_t *)NULL);
 	my_strftime(obuf, sizeof obuf, "%c\n", localtime(&tvec));
 	fprintf(fscript, _("Script started on %s"), obuf);
+	gettimeofday(&lastflush, NULL);
 
-	do {
-		if (die && flgs == 0) {
+	pfd[0].events = POLLIN;
+	pfd[1].fd = master;
+
+	while (1) {
+		if (die) {
 			/* ..child is dead, but it doesn't mean that there is
 			 * nothing in buffers.
 			 */
-			flgs = fcntl(master, F_GETFL, 0);
-			if (fcntl(master, F_SETFL, (flgs | O_NONBLOCK)) == -1)
-				break;
+			pfd[0].revents = 0;
+			pfd[1].revents = POLLIN;
+		} else {
+			/* read more input only when the previous one is sent */
+			pfd[0].fd = ineof || ilen ? -1 : STDIN_FILENO;
+			pfd[1].events = POLLIN | (ilen ? POLLOUT : 0);
+
+			if (dirty) {
+				long ms = FLUSH_INTERVAL - msec_since(&lastflush);
+
+				if (ms < 0)
+					ms = 0;
+				else if (ms > FLUSH_INTERVAL)
+					ms = FLUSH_INTERVAL;	/* clock set back */
+				timeout.tv_sec = ms / 1000;
+				timeout.tv_nsec = (ms % 1000) * 1000000;
+			}
+			cc = ppoll(pfd, 2, dirty ? &timeout : NULL, unblock_mask);
+			if (cc < 0) {
+				if (errno == EINTR)
+					continue;
+				warn(_("poll failed"));
+				fail();
+			}
+			if (cc == 0) {
+				/* the output has not been flushed for too long */
+				flush_output(&lastflush);
+				dirty = 0;
+				continue;
+			}
+		}
+
+		if (pfd[0].revents) {
+			cc = read(STDIN_FILENO, ibuf, sizeof(ibuf));
+			if (cc > 0) {
+				ilen = cc;
+				ioff = 0;
+			} else if (cc == 0 || (errno != EINTR && errno != EAGAIN)) {
+				struct termios mtt;
+
+				/* send the end of the input on to the shell */
+				ineof = 1;
+				ibuf[0] = tcgetattr(master, &mtt) == 0 ?
+						mtt.c_cc[VEOF] : '\004';
+				ilen = 1;
+				ioff = 0;
+			}
+		}
+
+		if (ilen && (pfd[1].revents & POLLOUT)) {
+			cc = write(master, ibuf + ioff, ilen);
+			if (cc > 0) {
+				ioff += cc;
+				ilen -= cc;
+			} else if (errno != EINTR && errno != EAGAIN) {
+				warn (_("write failed"));
+				fail();
+			}
 		}
+
+		if (!(pfd[1].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
 		if (tflg)
 			gettimeofday(&tv, NULL);
 
-		errno = 0;
-		cc = read(master, obuf, sizeof (obuf));
-
-		if (die && errno == EINTR && cc <= 0)
-			/* read() has been interrupted by SIGCHLD, try it again
-			 * with O_NONBLOCK
-			 */
+		cc = read(master, obuf, sizeof(obuf));
+		if (cc < 0 && (errno == EINTR || errno == EAGAIN)) {
+			if (die)
+				break;
 			continue;
+		}
 		if (cc <= 0)
-			break;
+			break;	/* EIO, the shell and its children are gone */
+
 		if (tflg) {
 			newtime = tv.tv_sec + (double) tv.tv_usec / 1000000;
 			fprintf(timingfd, "%f %zd\n", newtime - oldtime, cc);
 			oldtime = newtime;
 		}
-		wrt = write(STDOUT_FILENO, obuf, cc);
-		if (wrt < 0) {
+		if (write_all(STDOUT_FILENO, obuf, cc)) {
 			warn (_("write failed"));
 			fail();
 		}
-		fwrt = fwrite(obuf, 1, cc, fscript);
-		if (fwrt < cc) {
+		if (fwrite_all(obuf, 1, cc, fscript)) {
 			warn (_("cannot write script file"));
 			fail();
 		}
-		if (fflg)
-			fflush(fscript);
-	} while(1);
+		if (fflg) {
+			dirty = 1;
+			if (msec_since(&lastflush) >= FLUSH_INTERVAL) {
+				flush_output(&lastflush);
+				dirty = 0;
+			}
+		}
+	}
 
-	if (flgs)
-		fcntl(master, F_SETFL, flgs);
-	if (close_stream(timingfd) != 0)
-		errx(EXIT_FAILURE, _("write error"));
+	/* reap the shell if it has not been caught yet */
+	if (!die && waitpid(child, &childstatus, 0) == child)
+		die = 1;
 	done();
 }
 
@@ -422,6 +479,11 @@ doshell(void) {
 	close(master);
 	if (close_stream(fscript) != 0)
 		errx(EXIT_FAILURE, _("write error"));
+	fscript = NULL;
+	if (timingfd) {
+		fclose(timingfd);
+		timingfd = NULL;
+	}
 	dup2(slave, STDIN_FILENO);
 	dup2(slave, STDOUT_FILENO);
 	dup2(slave, STDERR_FILENO);
@@ -481,7 +543,7 @@ void __attribute__((__noreturn__))
 done(void) {
 	time_t tvec;
 
-	if (subchild) {
+	if (fscript) {
 		if (!qflg) {
 			char buf[BUFSIZ];
 			tvec = time((time_t *)NULL);
@@ -490,17 +552,21 @@ done(void) {
 		}
 		if (close_stream(fscript) != 0)
 			errx(EXIT_FAILURE, _("write error"));
-		close(master);
+		fscript = NULL;
+	}
+	if (timingfd && close_stream(timingfd) != 0)
+		errx(EXIT_FAILURE, _("write error"));
 
-		master = -1;
-	} else {
-		tcsetattr(STDIN_FILENO, TCSADRAIN, &tt);
-		if (!qflg)
-			printf(_("Script done, file is %s\n"), fname);
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &tt);
+	if (!qflg)
+		printf(_("Script done, file is %s\n"), fname);
 #ifdef HAVE_LIBUTEMPTER
-		if (master >= 0)
-			utempter_remove_record(master);
+	if (master >= 0)
+		utempter_remove_record(master);
 #endif
+	if (master >= 0) {
+		close(master);
+		master = -1;
 	}
 
 	if(eflg) {
@@ -0,0 +1,144 @@
+/*
+ * This testing program receives data from a socket for the logger tests
+ *
+ * Usage: test_sockrecv <unix|unix-dgram|tcp> <path> <command>
+ *
+ * The socket is bound before <command> is started by "sh -c", so the command
+ * does not race with the listener. For "tcp" the socket is bound to a free
+ * port on 127.0.0.1 and the port number is exported as $SOCKRECV_PORT, the
+ * <path> is ignored. Everything received is written to the standard output,
+ * every datagram is followed by a newline.
+ *
+ * This file may be redistributed under the terms of the GNU Public
+ * License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "c.h"
+#include "all-io.h"
+
+static int sink_socket(const char *type, const char *path, int *stream)
+{
+	int fd;
+
+	*stream = strcmp(type, "unix-dgram") != 0;
+
+	if (strcmp(type, "tcp") == 0) {
+		struct sockaddr_in in;
+		socklen_t sz = sizeof(in);
+		char port[16];
+
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			err(EXIT_FAILURE, "socket failed");
+		if (bind(fd, (struct sockaddr *) &in, sizeof(in)) != 0 ||
+		    getsockname(fd, (struct sockaddr *) &in, &sz) != 0)
+			err(EXIT_FAILURE, "bind failed");
+		snprintf(port, sizeof(port), "%d", ntohs(in.sin_port));
+		setenv("SOCKRECV_PORT", port, 1);
+	} else {
+		struct sockaddr_un un;
+
+		if (strlen(path) >= sizeof(un.sun_path))
+			errx(EXIT_FAILURE, "%s: pathname too long", path);
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, path);
+
+		fd = socket(AF_UNIX, *stream ? SOCK_STREAM : SOCK_DGRAM, 0);
+		if (fd < 0)
+			err(EXIT_FAILURE, "socket failed");
+		unlink(path);
+		if (bind(fd, (struct sockaddr *) &un, sizeof(un)) != 0)
+			err(EXIT_FAILURE, "%s: bind failed", path);
+	}
+
+	if (*stream && listen(fd, 1) != 0)
+		err(EXIT_FAILURE, "listen failed");
+	return fd;
+}
+
+/*
+ * Copies the received data to stdout, returns 0 on end of the connection.
+ */
+static int sink_read(int fd, int stream)
+{
+	char buf[BUFSIZ];
+	ssize_t n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n <= 0)
+		return 0;
+	if (write_all(STDOUT_FILENO, buf, n) ||
+	    (!stream && write_all(STDOUT_FILENO, "\n", 1)))
+		err(EXIT_FAILURE, "write failed");
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, conn = -1, stream, status = 0, done = 0;
+	pid_t pid;
+
+	if (argc != 4)
+		errx(EXIT_FAILURE, "usage: %s <unix|unix-dgram|tcp> <path> "
+				   "<command>", argv[0]);
+
+	fd = sink_socket(argv[1], argv[2], &stream);
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		err(EXIT_FAILURE, "fork failed");
+	if (pid == 0) {
+		close(fd);
+		execl("/bin/sh", "sh", "-c", argv[3], (char *) NULL);
+		err(EXIT_FAILURE, "exec failed");
+	}
+
+	/* read until the command exits and no more data are pending */
+	for (;;) {
+		struct pollfd pfd = { .fd = conn >= 0 ? conn : fd,
+				      .events = POLLIN };
+		int rc = poll(&pfd, 1, 100);
+
+		if (rc < 0 && errno != EINTR)
+			err(EXIT_FAILURE, "poll failed");
+		if (rc > 0) {
+			if (stream && conn < 0) {
+				conn = accept(fd, NULL, NULL);
+				if (conn < 0)
+					err(EXIT_FAILURE, "accept failed");
+			} else if (!sink_read(pfd.fd, stream)) {
+				close(conn);
+				conn = -1;
+			}
+		} else if (rc == 0) {
+			if (done)
+				break;
+			if (waitpid(pid, &status, WNOHANG) == pid)
+				done = 1;
+		}
+	}
+
+	close(fd);
+	if (strcmp(argv[1], "tcp") != 0)
+		unlink(argv[2]);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
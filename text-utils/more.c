@@ -58,6 +58,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 
 #include "strutils.h"
@@ -80,9 +81,9 @@
 
 #define Fopen(s,m)	(Currline = 0,file_pos=0,fopen(s,m))
 #define Ftell(f)	file_pos
-#define Fseek(f,off)	(file_pos=off,fseek(f,off,0))
-#define Getc(f)		(++file_pos, getc(f))
-#define Ungetc(c,f)	(--file_pos, ungetc(c,f))
+#define Fseek(f,off)	(file_pos=off,more_seek(f))
+#define Getc(f)		(++file_pos, more_getc(f))
+#define Ungetc(c,f)	(--file_pos, more_ungetc(c,f))
 #define putcerr(c)	fputc(c, stderr)
 #define putserr(s)	fputs(s, stderr)
 #define putsout(s)	fputs(s, stdout)
@@ -105,7 +106,7 @@ void rdline(register FILE *f);
 void copy_file(register FILE *f);
 void search(char buf[], FILE *file, register int n);
 void skipf(register int nskip);
-void skiplns(register int n, register FILE *f);
+int skiplns(register int n, register FILE *f);
 void screen(register FILE *f, register int num_lines);
 int command(char *filename, register FILE *f);
 void erasep(register int col);
@@ -190,6 +191,182 @@ struct {
 } context, screen_start;
 extern char PC;			/* pad character */
 
+/*
+ * Regular files are read from a mapping rather than by stdio, and the
+ * starts of every LINE_INDEX_STEP-th line are indexed when first needed,
+ * so that going back to a line does not read the file from the start.
+ *
+ * When the file turns out to be truncated or grown (e.g. a log file being
+ * rotated or written), the mapping is dropped and stdio is used from the
+ * current position on.  Pages past a new end of file are replaced by zeroed
+ * ones in the SIGBUS handler, so an access before that is noticed is not
+ * fatal.
+ */
+#define LINE_INDEX_STEP	64
+
+struct {
+	char *data;		/* the mapped file, or NULL */
+	long size;
+	long *index;		/* start of the line i * LINE_INDEX_STEP */
+	long nindex;
+	long last;		/* number of the last line known to start */
+	long lastpos;		/* start of the last known line */
+	long pagesize;
+	volatile sig_atomic_t truncated;	/* SIGBUS seen */
+} mfile;
+
+static void sigbus_handler(int sig __attribute__((__unused__)),
+			   siginfo_t *info, void *ctx __attribute__((__unused__)))
+{
+	char *addr = info->si_addr;
+
+	if (mfile.data && addr >= mfile.data && addr < mfile.data + mfile.size) {
+		addr = mfile.data + ((addr - mfile.data) & ~(mfile.pagesize - 1));
+		if (mmap(addr, mfile.pagesize, PROT_READ,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+			 -1, 0) != MAP_FAILED) {
+			mfile.truncated = 1;
+			return;
+		}
+	}
+	/* not ours, fault again and die */
+	signal(SIGBUS, SIG_DFL);
+}
+
+static void map_file(FILE *f, struct stat *st)
+{
+	struct sigaction sa;
+	void *data;
+
+	if (!S_ISREG(st->st_mode) || st->st_size <= 0 ||
+	    (unsigned long long) st->st_size > (unsigned long long) LONG_MAX)
+		return;
+	data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (data == MAP_FAILED)
+		return;
+	memset(&mfile, 0, sizeof(mfile));
+	mfile.data = data;
+	mfile.size = st->st_size;
+	mfile.pagesize = getpagesize();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = sigbus_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, NULL);
+}
+
+static void unmap_file(void)
+{
+	if (!mfile.data)
+		return;
+	munmap(mfile.data, mfile.size);
+	free(mfile.index);
+	memset(&mfile, 0, sizeof(mfile));
+}
+
+/*
+ * Drops the mapping if the file is no longer the mapped size, the reading
+ * continues by stdio at @pos
+ */
+static void check_mapped(FILE *f, long pos)
+{
+	struct stat st;
+
+	if (!mfile.data)
+		return;
+	if (!mfile.truncated && fstat(fileno(f), &st) == 0 &&
+	    st.st_size == mfile.size)
+		return;
+	unmap_file();
+	/* drop what stdio has buffered from the old file */
+	fflush(f);
+	fseek(f, pos, SEEK_SET);
+}
+
+/* Getc() without file_pos, which is already incremented */
+static inline int more_getc(FILE *f)
+{
+	if (mfile.data && file_pos <= mfile.size) {
+		int c = (unsigned char) mfile.data[file_pos - 1];
+
+		/* the rest of the page past a new end of file reads as zeros */
+		if (c && !mfile.truncated)
+			return c;
+	}
+	/* the file may have been truncated or grown */
+	check_mapped(f, file_pos - 1);
+	if (mfile.data)
+		return file_pos <= mfile.size ?
+			(unsigned char) mfile.data[file_pos - 1] : EOF;
+	return getc(f);
+}
+
+static inline void more_ungetc(int c, FILE *f)
+{
+	if (!mfile.data)
+		ungetc(c, f);
+}
+
+static inline int more_seek(FILE *f)
+{
+	if (!mfile.data)
+		return fseek(f, file_pos, SEEK_SET);
+	return 0;
+}
+
+/* the end of the line starting at pos (the newline, or the end of file) */
+static long line_end(long pos)
+{
+	char *p = memchr(mfile.data + pos, '\n', mfile.size - pos);
+
+	return p ? p - mfile.data : mfile.size;
+}
+
+/*
+ * Returns the offset of the start of line n (after the n-th newline) of
+ * the mapped file, or -1 if there are not as many lines.
+ */
+static long line_start(long n)
+{
+	long pos;
+
+	if (!mfile.nindex) {
+		mfile.index = xmalloc(16 * sizeof(long));
+		mfile.index[mfile.nindex++] = 0;
+	}
+	/* start from the nearest known line */
+	if (n >= mfile.last) {
+		pos = mfile.lastpos;
+		n -= mfile.last;
+	} else {
+		pos = mfile.index[n / LINE_INDEX_STEP];
+		n %= LINE_INDEX_STEP;
+	}
+
+	while (n > 0) {
+		pos = line_end(pos);
+		if (pos == mfile.size)
+			return -1;
+		pos++;
+		n--;
+
+		/* extending the index */
+		if (pos > mfile.lastpos) {
+			mfile.last++;
+			mfile.lastpos = pos;
+			if (mfile.last % LINE_INDEX_STEP == 0) {
+				if ((mfile.nindex & (mfile.nindex - 1)) == 0 &&
+				    mfile.nindex >= 16)
+					mfile.index = xrealloc(mfile.index,
+						2 * mfile.nindex * sizeof(long));
+				mfile.index[mfile.nindex++] = pos;
+			}
+		}
+	}
+	return pos;
+}
+
 #ifdef HAVE_NCURSES_H
 # include <ncurses.h>
 #elif defined(HAVE_NCURSES_NCURSES_H)
@@ -506,6 +683,7 @@ int main(int argc, char **argv)
 			}
 			sigsetjmp(restore, 1);
 			fflush(stdout);
+			unmap_file();
 			fclose(f);
 			screen_start.line = screen_start.chrctr = 0L;
 			context.line = context.chrctr = 0L;
@@ -607,6 +785,7 @@ FILE *checkf(register char *fs, int *clearfirst)
 	if (magic(f, fs))
 		return ((FILE *)NULL);
 	fcntl(fileno(f), F_SETFD, FD_CLOEXEC);
+	map_file(f, &stbuf);
 	c = Getc(f);
 	*clearfirst = (c == '\f');
 	Ungetc(c, f);
@@ -780,10 +959,16 @@ void __attribute__((__noreturn__)) end_it(int dummy __attribute__((__unused__)))
 
 void copy_file(register FILE *f)
 {
-	register int c;
+	char buf[BUFSIZ];
+	size_t n;
 
-	while ((c = getc(f)) != EOF)
-		putchar(c);
+	/* read the file as it is now, it may be changing */
+	if (mfile.data) {
+		unmap_file();
+		fseek(f, file_pos, SEEK_SET);
+	}
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, n, stdout);
 }
 
 #define ringbell()	putcerr('\007')
@@ -1171,7 +1356,6 @@ int command(char *filename, register FILE *f)
 {
 	register int nlines;
 	register int retval = 0;
-	register int c;
 	char colonch;
 	int done;
 	char comchar, cmdbuf[INIT_BUF];
@@ -1237,9 +1421,15 @@ int command(char *filename, register FILE *f)
 					--initline;
 				if (initline < 0)
 					initline = 0;
-				Fseek(f, 0L);
-				Currline = 0;	/* skiplns() will make Currline correct */
-				skiplns(initline, f);
+				check_mapped(f, file_pos);
+				if (mfile.data && line_start(initline) >= 0) {
+					Fseek(f, line_start(initline));
+					Currline = initline;
+				} else {
+					Fseek(f, 0L);
+					Currline = 0;	/* skiplns() will make Currline correct */
+					skiplns(initline, f);
+				}
 				if (!noscroll) {
 					ret(dlines + 1);
 				} else {
@@ -1282,15 +1472,10 @@ int command(char *filename, register FILE *f)
 				cleareol();
 			putchar('\n');
 
-			while (nlines > 0) {
-				while ((c = Getc(f)) != '\n')
-					if (c == EOF) {
-						retval = 0;
-						done++;
-						goto endsw;
-					}
-				Currline++;
-				nlines--;
+			if (skiplns(nlines, f)) {
+				retval = 0;
+				done++;
+				goto endsw;
 			}
 			ret(dlines);
 		case '\n':
@@ -1573,6 +1758,72 @@ void do_shell(char *filename)
 	execute(filename, shell, shell, "-c", shell_line, 0);
 }
 
+/* Is the basic regular expression a plain string? */
+static int is_literal_re(const char *re)
+{
+	return *re && !strpbrk(re, ".[]*^$\\");
+}
+
+/*
+ * search() in the mapped file. The lines are found by memchr(), and a
+ * plain string by memmem() over the whole rest of the file, rather than
+ * reading the file char by char. On success, returns the start of the
+ * n-th matching line and the number of lines up to it in lncount, and the
+ * file is positioned after it, with Line and Currline set as rdline()
+ * would.
+ */
+static long search_mapped(regex_t *re, const char *buf, int n, int *lncount)
+{
+	size_t relen = strlen(buf);
+	int literal = is_literal_re(buf);
+	long pos = file_pos > mfile.size ? mfile.size : file_pos;
+	long start = pos, end = 0, len;
+	char *line = NULL;
+	size_t linesz = 0;
+
+	while (pos < mfile.size) {
+		if (literal) {
+			char *p = memmem(mfile.data + pos, mfile.size - pos,
+					 buf, relen);
+			if (!p)
+				break;
+			end = p - mfile.data;
+			p = memrchr(mfile.data + pos, '\n', end - pos);
+			start = p ? p - mfile.data + 1 : pos;
+		} else
+			start = pos;
+		end = line_end(start);
+		len = end - start;
+
+		if (!literal) {
+			if ((size_t) len + 1 > linesz) {
+				linesz = len + 1;
+				line = xrealloc(line, linesz);
+			}
+			memcpy(line, mfile.data + start, len);
+			line[len] = '\0';
+		}
+		pos = end + 1;
+		if ((literal || regexec(re, line, 0, NULL, 0) == 0) && --n == 0)
+			break;
+	}
+	free(line);
+	if (n)
+		return -1;
+
+	/* count the lines, and set the line as rdline() does */
+	*lncount = 1;
+	for (pos = file_pos; (pos = line_end(pos)) < end; pos++)
+		(*lncount)++;
+	Currline += *lncount - (end < mfile.size ? 0 : 1);
+	prepare_line_buffer();
+	len = end - start < (long) LineLen - 1 ? end - start : (long) LineLen - 1;
+	memcpy(Line, mfile.data + start, len);
+	Line[len] = '\0';
+	Fseek(NULL, end + 1);
+	return start;
+}
+
 /* Search for nth occurrence of regular expression contained in buf in
  * the file */
 void search(char buf[], FILE *file, register int n)
@@ -1581,8 +1832,8 @@ void search(char buf[], FILE *file, register int n)
 	register long line1 = startline;
 	register long line2 = startline;
 	register long line3 = startline;
-	register int lncount;
-	int saveln, rc;
+	int lncount;
+	int saveln, rc, found = 0;
 	regex_t re;
 
 	context.line = saveln = Currline;
@@ -1593,48 +1844,76 @@ void search(char buf[], FILE *file, register int n)
 		regerror(rc, &re, s, sizeof s);
 		more_error(s);
 	}
-	while (!feof(file)) {
-		line3 = line2;
-		line2 = line1;
-		line1 = Ftell(file);
-		rdline(file);
-		lncount++;
-		if (regexec(&re, Line, 0, NULL, 0) == 0) {
-			if (--n == 0) {
-				if (lncount > 3 || (lncount > 1 && no_intty)) {
-					putchar('\n');
-					if (clreol)
-						cleareol();
-					putsout(_("...skipping\n"));
-				}
-				if (!no_intty) {
-					Currline -=
-					    (lncount >= 3 ? 3 : lncount);
-					Fseek(file, line3);
-					if (noscroll) {
-						if (clreol) {
-							home();
-							cleareol();
-						} else
-							doclear();
-					}
-				} else {
-					kill_line();
-					if (noscroll) {
-						if (clreol) {
-							home();
-							cleareol();
-						} else
-							doclear();
-					}
-					puts(Line);
-				}
+	check_mapped(file, file_pos);
+	if (mfile.data) {
+		line1 = search_mapped(&re, buf, n, &lncount);
+		if (mfile.truncated) {
+			/* truncated under us, search again by stdio from
+			 * where search_mapped() started */
+			check_mapped(file, startline);
+			file_pos = startline;
+			Currline = saveln;
+			line1 = startline;
+			lncount = 0;
+		}
+	}
+	if (mfile.data) {
+		if (line1 >= 0) {
+			int i;
+
+			/* back to the start of the two lines before it */
+			for (line3 = line1, i = 0; i < 2 && line3 > startline; i++) {
+				char *p = memrchr(mfile.data + startline, '\n',
+						  line3 - 1 - startline);
+				line3 = p ? p - mfile.data + 1 : startline;
+			}
+			found = 1;
+		}
+	} else {
+		while (!feof(file)) {
+			line3 = line2;
+			line2 = line1;
+			line1 = Ftell(file);
+			rdline(file);
+			lncount++;
+			if (regexec(&re, Line, 0, NULL, 0) == 0 && --n == 0) {
+				found = 1;
 				break;
 			}
 		}
 	}
+	if (found) {
+		if (lncount > 3 || (lncount > 1 && no_intty)) {
+			putchar('\n');
+			if (clreol)
+				cleareol();
+			putsout(_("...skipping\n"));
+		}
+		if (!no_intty) {
+			Currline -=
+			    (lncount >= 3 ? 3 : lncount);
+			Fseek(file, line3);
+			if (noscroll) {
+				if (clreol) {
+					home();
+					cleareol();
+				} else
+					doclear();
+			}
+		} else {
+			kill_line();
+			if (noscroll) {
+				if (clreol) {
+					home();
+					cleareol();
+				} else
+					doclear();
+			}
+			puts(Line);
+		}
+	}
 	regfree(&re);
-	if (feof(file)) {
+	if (!found) {
 		if (!no_intty) {
 			Currline = saveln;
 			Fseek(file, startline);
@@ -1710,18 +1989,44 @@ void execute(char *filename, char *cmd, ...)
 	prompt(filename);
 }
 
-/* Skip n lines in the file f */
-void skiplns(register int n, register FILE *f)
+/* Skip n lines in the file f, returns the number of lines not skipped
+ * because of EOF */
+int skiplns(register int n, register FILE *f)
 {
 	register int c;
 
+	check_mapped(f, file_pos);
+	if (mfile.data && n > 0 && file_pos <= mfile.size) {
+		long pos;
+
+		/* jump by the index, if we are at a line start */
+		if (line_start(Currline) == file_pos &&
+		    (pos = line_start(Currline + n)) >= 0) {
+			Fseek(f, pos);
+			Currline += n;
+			return 0;
+		}
+		while (n > 0 && (pos = line_end(file_pos)) < mfile.size) {
+			Fseek(f, pos + 1);
+			n--;
+			Currline++;
+		}
+		if (n == 0)
+			return 0;
+		/* read the EOF, as Getc() would */
+		Fseek(f, mfile.size);
+		file_pos++;
+		return n;
+	}
+
 	while (n > 0) {
 		while ((c = Getc(f)) != '\n')
 			if (c == EOF)
-				return;
+				return n;
 		n--;
 		Currline++;
 	}
+	return 0;
 }
 
 /* Skip nskip files in the file list (from the command line).  Nskip may
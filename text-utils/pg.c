@@ -39,6 +39,7 @@
 #endif
 #include <sys/termios.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <regex.h>
 #include <stdio.h>
 #include <string.h>
@@ -67,6 +68,8 @@
 #include "strutils.h"
 
 #define	READBUF		LINE_MAX	/* size of input buffer */
+#define	READBLOCK	(128 * 1024)	/* size of reads for the line index */
+#define	INDEXAHEAD	65536		/* lines indexed ahead at the prompt */
 #define CMDBUF		255		/* size of command buffer */
 #define	TABSIZE		8		/* spaces consumed by tab character */
 
@@ -97,6 +100,21 @@ struct {
 	char addon;
 } cmd;
 
+/* Line index of a seekable input file, see index_block() */
+struct {
+	FILE *f;		/* input file, or NULL */
+	const char *name;	/* for error messages */
+	FILE *find;		/* index file, one off_t per line */
+	off_t fpos;		/* offset of the first line not indexed */
+	off_t nlines;		/* number of lines indexed */
+	off_t ahead;		/* index up to this line at the prompt */
+	int eof;		/* the whole file is indexed */
+	char *buf;		/* READBLOCK bytes read from f */
+	off_t cache[1024];	/* index entries read back from find */
+	off_t cfirst;		/* line of cache[0] */
+	size_t cn;		/* number of entries in cache */
+} idx;
+
 /* Position of file arguments on argv[] to main() */
 struct {
 	int first;
@@ -130,6 +148,9 @@ long startline;			/* start line from argv[] */
 int nextfile = 1;		/* files to advance */
 jmp_buf jmpenv;			/* jump from signal handlers */
 int canjump;			/* jmpenv is valid */
+int indexing;			/* interrupt the indexing on signals */
+volatile sig_atomic_t interrupted;	/* got a signal while indexing */
+char refix[CMDBUF];		/* literal string matches of re start with */
 wchar_t wbuf[READBUF];		/* used in several widechar routines */
 
 char *copyright;
@@ -349,6 +370,10 @@ static void skip(int direction)
 /* Signal handler while reading from input file. */
 static void sighandler(int signum)
 {
+	if (indexing && (signum == SIGINT || signum == SIGQUIT)) {
+		interrupted = 1;
+		return;
+	}
 	if (canjump && (signum == SIGINT || signum == SIGQUIT))
 		longjmp(jmpenv, signum);
 	tcsetattr(STDOUT_FILENO, TCSADRAIN, &otio);
@@ -585,6 +610,90 @@ static int getcount(char *cmdstr)
 	return i;
 }
 
+/* Add a line at offset pos to the index. */
+static void index_line(off_t pos)
+{
+	fwrite_all(&pos, sizeof pos, 1, idx.find);
+	idx.nlines++;
+}
+
+/* Index the lines in the next block of the input file, the same way as
+ * pgfile() does when it reads the file with fgets(): lines longer than
+ * READBUF - 1 are cut, and unless -f is given, split where endline()
+ * splits them on the screen.  Returns 1 if the whole file is indexed. */
+static int index_block(void)
+{
+	char b[READBUF + 1], *p;
+	ssize_t n;
+	size_t i, len;
+
+	if (idx.eof)
+		return 1;
+	n = pread(fileno(idx.f), idx.buf, READBLOCK, idx.fpos);
+	if (n < 0) {
+		if (errno == EINTR)
+			return 0;
+		warn("%s", idx.name);
+		n = 0;
+	}
+	for (i = 0; i < (size_t)n; i += len) {
+		char *s = idx.buf + i, *nl;
+
+		len = n - i < READBUF - 1 ? n - i : READBUF - 1;
+		nl = memchr(s, '\n', len);
+		if (nl)
+			len = nl - s + 1;
+		else if (len < READBUF - 1 && n == READBLOCK)
+			/* The rest of the line is in the next block. */
+			break;
+		if (*s == '\0') {
+			/* Ends the input, as in pgfile(). */
+			n = 0;
+			break;
+		}
+		index_line(idx.fpos + i);
+		/* Lines without tabs that fit the screen are not split.
+		 * In multibyte locales endline() decides, as invalid
+		 * sequences may take more columns than bytes. */
+		if (fflag || (MB_CUR_MAX == 1
+			      && len - (nl != NULL) <= (size_t)ttycols
+			      && !memchr(s, '\t', len)))
+			continue;
+		memcpy(b, s, len);
+		b[len] = '\0';
+		p = b;
+		while (*(p = endline(ttycols, p)) != '\0')
+			index_line(idx.fpos + i + (p - b));
+	}
+	idx.fpos += i;
+	if (n == 0)
+		idx.eof = 1;
+	return idx.eof;
+}
+
+/* Index the input file up to the given line.  Returns 1 if interrupted
+ * by a signal. */
+static int index_lines(off_t line)
+{
+	interrupted = 0;
+	indexing = 1;
+	while (idx.nlines <= line && !interrupted && !index_block())
+		;
+	indexing = 0;
+	return interrupted;
+}
+
+/* Index the input file ahead, up to idx.ahead, while no key is pressed.
+ * The rest is indexed only when a command needs it. */
+static void index_idle(void)
+{
+	struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLIN };
+
+	while (idx.f && !idx.eof && idx.nlines <= idx.ahead
+	       && poll(&pfd, 1, 0) == 0)
+		index_block();
+}
+
 /* Read what the user writes at the prompt. This is tricky because we
  * check for valid input. */
 static void prompt(long long pageno)
@@ -614,6 +723,7 @@ static void prompt(long long pageno)
 	tcsetattr(STDOUT_FILENO, TCSADRAIN, &tio);
 	tcflush(STDOUT_FILENO, TCIFLUSH);
 	for (;;) {
+		index_idle();
 		switch (read(STDOUT_FILENO, &key, 1)) {
 		case 0:
 			quit(0);
@@ -874,6 +984,115 @@ static void __attribute__((__noreturn__)) tmperr(FILE *f, const char *ftype)
 	quit(++exitstatus);
 }
 
+/* Set refix to the literal string a match of the basic regular
+ * expression s starts with, if there is one.  Non-ASCII characters and,
+ * as colb() may turn invalid sequences into it, '?' end the string in
+ * multibyte locales. */
+static void setrefix(const char *s)
+{
+	size_t n = 0;
+
+	*refix = '\0';
+	if (strstr(s, "\\|"))
+		return;
+	if (*s == '^')
+		s++;
+	while (s[n] && !strchr(".[]*^$\\", s[n])
+	       && (MB_CUR_MAX == 1 || (cuc(s[n]) < 0x80 && s[n] != '?')))
+		n++;
+	/* The last character may be optional. */
+	if (n && (s[n] == '*' || s[n] == '\\'))
+		n--;
+	memcpy(refix, s, n);
+	refix[n] = '\0';
+}
+
+/* Return the offset of an indexed line. */
+static off_t line_pos(off_t line)
+{
+	if (line < idx.cfirst || line >= idx.cfirst + (off_t)idx.cn) {
+		idx.cfirst = line;
+		fseeko(idx.find, line * sizeof(off_t), SEEK_SET);
+		idx.cn = fread(idx.cache, sizeof(off_t),
+			       ARRAY_SIZE(idx.cache), idx.find);
+		if (idx.cn == 0)
+			tmperr(idx.find, "index");
+		fseeko(idx.find, (off_t)0, SEEK_END);
+	}
+	return idx.cache[line - idx.cfirst];
+}
+
+/* Find the first refix or backspace at or after pos, by block reads of
+ * the input file.  Sets nl to the last newline before it, or pos - 1.
+ * Returns -1 if there is none. */
+static off_t find_hit(off_t pos, off_t *nl)
+{
+	size_t len = strlen(refix);
+	ssize_t n;
+	char *p, *q;
+
+	*nl = pos - 1;
+	for (;;) {
+		n = pread(fileno(idx.f), idx.buf, READBLOCK, pos);
+		if (n < 0 && errno == EINTR && !interrupted)
+			continue;
+		if (n <= 0 || interrupted)
+			return -1;
+		p = memmem(idx.buf, n, refix, len);
+		q = memchr(idx.buf, '\b', p ? (size_t)(p - idx.buf) : (size_t)n);
+		if (q)
+			p = q;
+		q = memrchr(idx.buf, '\n', p ? (size_t)(p - idx.buf) : (size_t)n);
+		if (q)
+			*nl = pos + (q - idx.buf);
+		if (p)
+			return pos + (p - idx.buf);
+		if (n < READBLOCK)
+			return -1;
+		pos += n - (len - 1);
+	}
+}
+
+/* Search forward from line for the count-th line matching re, reading the
+ * input file by blocks.  Only the lines which contain the literal start
+ * of re (or backspaces, see colb()) in the text pgfile() would check are
+ * checked with regexec().  Returns the line, or -1 if not found or
+ * interrupted. */
+static off_t search_lines(off_t line, unsigned count)
+{
+	char b[READBUF + 1], *p;
+	off_t pos, hit = -1, nl = -1;
+	ssize_t n;
+
+	interrupted = 0;
+	indexing = 1;
+	for (;; line++) {
+		while (idx.nlines <= line && !interrupted && !index_block())
+			;
+		if (idx.nlines <= line || interrupted)
+			break;
+		pos = line_pos(line);
+		if (hit < pos && (hit = find_hit(pos, &nl)) < 0)
+			break;
+		/* The line cannot contain the hit. */
+		if (pos <= nl || hit - pos >= READBUF - 1)
+			continue;
+		n = pread(fileno(idx.f), b, READBUF - 1, pos);
+		if (n <= 0)
+			continue;
+		b[n] = '\0';
+		if ((p = memchr(b, '\n', n)) != NULL)
+			*++p = '\0';
+		colb(b);
+		if (regexec(&re, b, 0, NULL, 0) == 0 && --count == 0) {
+			indexing = 0;
+			return line;
+		}
+	}
+	indexing = 0;
+	return -1;
+}
+
 /* Read the file and respond to user input.  Beware: long and ugly. */
 static void pgfile(FILE *f, const char *name)
 {
@@ -926,6 +1145,14 @@ static void pgfile(FILE *f, const char *name)
 		warn(_("Cannot create tempfile"));
 		quit(++exitstatus);
 	}
+	if (nobuf) {
+		/* Index the file by blocks, see index_block(). */
+		memset(&idx, 0, sizeof idx);
+		idx.f = f;
+		idx.name = name;
+		idx.find = find;
+		idx.buf = xmalloc(READBLOCK);
+	}
 	if (searchfor) {
 		search = FORWARD;
 		oldline = 0;
@@ -938,9 +1165,41 @@ static void pgfile(FILE *f, const char *name)
 			goto newcmd;
 		}
 		remembered = 1;
+		setrefix(searchfor);
 	}
 
 	for (line = startline;;) {
+		if (search == FORWARD && remembered == 1 && idx.f && *refix) {
+			/* Skip to the matching line by block reads. */
+			if ((line = search_lines(line, searchcount)) < 0) {
+				line = oldline;
+				search = searchcount = 0;
+				mesg(_("Pattern not found"));
+				goto newcmd;
+			}
+			searchcount = 1;
+		}
+		if (idx.f && line >= bline && eofline == 0) {
+			/* Index up to the line by block reads. */
+			if (index_lines(line)) {
+				/* We got a signal. */
+				if (search) {
+					line = oldline;
+					search = searchcount = 0;
+					mesg(_("Pattern not found"));
+					goto newcmd;
+				}
+				*b = '\0';
+				dline = pagelen;
+				goto gotline;
+			}
+			fline = bline = idx.nlines;
+			if (line >= bline) {
+				eofline = fline;
+				eof = 1;
+				goto gotline;
+			}
+		}
 		/* Get a line from input file or buffer. */
 		if (line < bline) {
 			fseeko(find, line * sizeof pos, SEEK_SET);
@@ -1005,6 +1264,7 @@ static void pgfile(FILE *f, const char *name)
 			/* eofline != 0 */
 			eof = 1;
 		}
+ gotline:
 		if (search == FORWARD && remembered == 1) {
 			if (eof) {
 				line = oldline;
@@ -1081,6 +1341,7 @@ static void pgfile(FILE *f, const char *name)
 					break;
 				mesg(_("(EOF)"));
 			}
+			idx.ahead = line + INDEXAHEAD;
 			prompt((line - 1) / pagelen + 1);
 			switch (cmd.key) {
 			case '/':
@@ -1103,6 +1364,7 @@ static void pgfile(FILE *f, const char *name)
 						goto newcmd;
 					}
 					remembered = 1;
+					setrefix(p);
 				} else if (remembered == 0) {
 					mesg(_("No remembered search string"));
 					goto newcmd;
@@ -1129,6 +1391,7 @@ static void pgfile(FILE *f, const char *name)
 						goto newcmd;
 					}
 					remembered = 1;
+					setrefix(p);
 				} else if (remembered == 0) {
 					mesg(_("No remembered search string"));
 					goto newcmd;
@@ -1193,7 +1456,12 @@ static void pgfile(FILE *f, const char *name)
 				}
 				/* Advance to EOF. */
 				fseeko(find, (off_t)0, SEEK_END);
-				for (;;) {
+				if (idx.f) {
+					if (!index_lines(LONG_MAX)) {
+						fline = bline = idx.nlines;
+						eofline = fline;
+					}
+				} else for (;;) {
 					if (!nobuf)
 						fseeko(fbuf, (off_t)0,
 						       SEEK_END);
@@ -1428,6 +1696,10 @@ static void pgfile(FILE *f, const char *name)
 	fclose(find);
 	if (!nobuf)
 		fclose(fbuf);
+	else {
+		free(idx.buf);
+		memset(&idx, 0, sizeof idx);
+	}
 }
 
 static int parse_arguments(int arg, int argc, char **argv)
@@ -36,6 +36,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <sys/sendfile.h>
 #ifdef HAVE_INOTIFY_INIT
 #include <sys/inotify.h>
 #endif
@@ -48,18 +50,41 @@
 
 #define DEFAULT_LINES  10
 
+/* the largest chunk to copy by one sendfile() call */
+#define SENDFILE_MAX	(1024 * 1024)
+
+#ifdef HAVE_INOTIFY_INIT
+#define EVENTS		(IN_MODIFY|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)
+#define DIR_EVENTS	(IN_CREATE|IN_MOVED_TO|IN_ONLYDIR)
+#define NEVENTS		64
+#endif
+
+struct tailf_file {
+	const char	*name;
+	const char	*base;		/* the last component of the name */
+	int		fd;		/* -1 if not followed (now) */
+	off_t		size;		/* printed so far */
+	int		wd;		/* inotify watch of the file */
+	int		dirwd;		/* inotify watch of its directory */
+	unsigned int	moved : 1,	/* renamed, wait for a new file */
+			dirty : 1;	/* modified, to be rolled */
+};
+
+static struct tailf_file *files;
+static size_t nfiles;
+
+static struct tailf_file *last_printed;	/* for the headers */
+static int use_sendfile = 1;
+
+/* the last lines of a file that cannot be read backwards */
 static void
-tailf(const char *filename, int lines)
+tailf_stream(FILE *str, int lines)
 {
 	char *buf, *p;
 	int  head = 0;
 	int  tail = 0;
-	FILE *str;
 	int  i;
 
-	if (!(str = fopen(filename, "r")))
-		err(EXIT_FAILURE, _("cannot open %s"), filename);
-
 	buf = xmalloc((lines ? lines : 1) * BUFSIZ);
 	p = buf;
 	while (fgets(p, BUFSIZ, str)) {
@@ -79,113 +104,328 @@ tailf(const char *filename, int lines)
 		for (i = head; i < tail; i++)
 			fputs(buf + (i * BUFSIZ), stdout);
 	}
-
-	fflush(stdout);
 	free(buf);
-	fclose(str);
+}
+
+/*
+ * Returns the offset of the last @lines lines in the first @size bytes of
+ * the file. The file is read in blocks backwards from @size, so only the
+ * blocks with the lines are read, no matter how big the file is.
+ */
+static off_t
+find_last_lines(int fd, const char *filename, off_t size, int lines)
+{
+	char buf[BUFSIZ];
+	off_t pos = size;
+	int last = 1;
+
+	if (!lines)
+		return size;
+
+	while (pos > 0) {
+		/* keep the reads aligned to the block size */
+		size_t len = pos % BUFSIZ ? pos % BUFSIZ : BUFSIZ;
+		char *p;
+		ssize_t rc;
+
+		pos -= len;
+		rc = pread(fd, buf, len, pos);
+		if (rc < 0)
+			err(EXIT_FAILURE, _("read failed: %s"), filename);
+		if ((size_t) rc != len)
+			return pos;	/* truncated meanwhile */
+
+		/* the newline at the end of the file does not start a line */
+		if (last && buf[len - 1] == '\n')
+			len--;
+		last = 0;
+
+		for (p = buf + len; (p = memrchr(buf, '\n', p - buf)); )
+			if (--lines == 0)
+				return pos + (p - buf) + 1;
+	}
+	return 0;
+}
+
+/* with more files, print the name when the output switches to another */
+static void
+print_header(struct tailf_file *tf)
+{
+	if (nfiles > 1 && last_printed != tf)
+		printf("%s==> %s <==\n", last_printed ? "\n" : "", tf->name);
+	last_printed = tf;
 }
 
 static void
-roll_file(const char *filename, off_t *size)
+tailf(struct tailf_file *tf, int lines)
 {
 	char buf[BUFSIZ];
-	int fd;
 	struct stat st;
 	off_t pos;
 
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		err(EXIT_FAILURE, _("cannot open %s"), filename);
+	if (fstat(tf->fd, &st) != 0)
+		err(EXIT_FAILURE, _("stat failed %s"), tf->name);
 
-	if (fstat(fd, &st) == -1)
-		err(EXIT_FAILURE, _("stat failed %s"), filename);
+	print_header(tf);
+	tf->size = st.st_size;
 
-	if (st.st_size == *size) {
-		close(fd);
-		return;
+	if (!S_ISREG(st.st_mode)) {
+		int fd = dup(tf->fd);
+		FILE *str = fd >= 0 ? fdopen(fd, "r") : NULL;
+
+		if (!str)
+			err(EXIT_FAILURE, _("cannot open %s"), tf->name);
+		tailf_stream(str, lines);
+		fclose(str);
+		goto done;
 	}
 
-	if (lseek(fd, *size, SEEK_SET) != (off_t)-1) {
-		ssize_t rc, wc;
+	/* print up to the size, the rest is printed when following */
+	pos = find_last_lines(tf->fd, tf->name, tf->size, lines);
+	while (pos < tf->size) {
+		size_t len = tf->size - pos < BUFSIZ ? tf->size - pos : BUFSIZ;
+		ssize_t rc = pread(tf->fd, buf, len, pos);
 
-		while ((rc = read(fd, buf, sizeof(buf))) > 0) {
-			wc = write(STDOUT_FILENO, buf, rc);
-			if (rc != wc)
-				warnx(_("incomplete write to \"%s\" (written %zd, expected %zd)\n"),
-					filename, wc, rc);
-		}
-		fflush(stdout);
+		if (rc < 0)
+			err(EXIT_FAILURE, _("read failed: %s"), tf->name);
+		if (rc == 0)
+			break;
+		fwrite(buf, 1, rc, stdout);
+		pos += rc;
 	}
+done:
+	fflush(stdout);
+}
 
-	pos = lseek(fd, 0, SEEK_CUR);
+/* copy everything after the printed size to stdout */
+static void
+copy_data(struct tailf_file *tf)
+{
+	char buf[BUFSIZ];
+	ssize_t rc, wc;
 
-	/* If we've successfully read something, use the file position, this
-	 * avoids data duplication. If we read nothing or hit an error, reset
-	 * to the reported size, this handles truncated files.
-	 */
-	*size = (pos != -1 && pos != *size) ? pos : st.st_size;
+	while (use_sendfile) {
+		off_t off = tf->size;
 
-	close(fd);
+		rc = sendfile(STDOUT_FILENO, tf->fd, &off, SENDFILE_MAX);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			/* e.g. stdout is a terminal, use read and write */
+			use_sendfile = 0;
+			break;
+		}
+		if (rc == 0)
+			return;
+		tf->size = off;
+	}
+
+	while ((rc = pread(tf->fd, buf, sizeof(buf), tf->size)) > 0) {
+		wc = write(STDOUT_FILENO, buf, rc);
+		if (rc != wc)
+			warnx(_("incomplete write to \"%s\" (written %zd, expected %zd)\n"),
+				tf->name, wc, rc);
+		tf->size += rc;
+	}
 }
 
 static void
-watch_file(const char *filename, off_t *size)
+roll_file(struct tailf_file *tf)
 {
-	do {
-		roll_file(filename, size);
-		usleep(250000);
-	} while(1);
+	struct stat st;
+
+	if (fstat(tf->fd, &st) == -1)
+		err(EXIT_FAILURE, _("stat failed %s"), tf->name);
+
+	if (st.st_size == tf->size)
+		return;
+
+	/* truncated, continue from the new size */
+	if (st.st_size < tf->size) {
+		tf->size = st.st_size;
+		return;
+	}
+
+	print_header(tf);
+	fflush(stdout);
+	copy_data(tf);
 }
 
+static int
+followed_files(void)
+{
+	size_t i;
+	int n = 0;
 
-#ifdef HAVE_INOTIFY_INIT
+	for (i = 0; i < nfiles; i++)
+		n += files[i].fd >= 0;
+	return n;
+}
 
-#define EVENTS		(IN_MODIFY|IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)
-#define NEVENTS		4
+/*
+ * Print the rest of the (deleted or renamed) file and close it. If there
+ * is a new file of the same name, follow it from the start.
+ */
+static void
+reopen_file(struct tailf_file *tf, int ifd)
+{
+	if (tf->fd >= 0) {
+		roll_file(tf);
+		close(tf->fd);
+#ifdef HAVE_INOTIFY_INIT
+		if (ifd >= 0 && tf->wd >= 0)
+			inotify_rm_watch(ifd, tf->wd);
+#endif
+	}
+	tf->wd = -1;
+	tf->moved = 0;
+	tf->size = 0;
+	tf->fd = open(tf->name, O_RDONLY);
+	if (tf->fd < 0)
+		return;
+#ifdef HAVE_INOTIFY_INIT
+	if (ifd >= 0)
+		tf->wd = inotify_add_watch(ifd, tf->name, EVENTS);
+#endif
+	roll_file(tf);
+}
 
+/* is there another file of the same name? */
 static int
-watch_file_inotify(const char *filename, off_t *size)
+is_replaced(struct tailf_file *tf)
 {
-	char buf[ NEVENTS * sizeof(struct inotify_event) ];
-	int fd, ffd, e;
-	ssize_t len;
+	struct stat st, fst;
 
-	fd = inotify_init();
-	if (fd == -1)
-		return 0;
+	return stat(tf->name, &st) == 0 && fstat(tf->fd, &fst) == 0 &&
+	       (st.st_dev != fst.st_dev || st.st_ino != fst.st_ino);
+}
+
+static void
+watch_files(void)
+{
+	size_t i;
+
+	while (followed_files()) {
+		for (i = 0; i < nfiles; i++) {
+			struct tailf_file *tf = &files[i];
+			struct stat st;
+
+			if (tf->fd < 0) {
+				/* deleted, follow a new file of the same name */
+				if (stat(tf->name, &st) == 0)
+					reopen_file(tf, -1);
+				continue;
+			}
+			roll_file(tf);
+			if (is_replaced(tf))
+				reopen_file(tf, -1);
+			else if (fstat(tf->fd, &st) == 0 && st.st_nlink == 0) {
+				close(tf->fd);
+				tf->fd = -1;
+			}
+		}
+		usleep(250000);
+	}
+}
+
+#ifdef HAVE_INOTIFY_INIT
+
+static void
+add_watches(int ifd, struct tailf_file *tf)
+{
+	char *dir = xstrdup(tf->name);
+	char *p = strrchr(dir, '/');
 
-	ffd = inotify_add_watch(fd, filename, EVENTS);
-	if (ffd == -1) {
+	tf->wd = inotify_add_watch(ifd, tf->name, EVENTS);
+	if (tf->wd == -1) {
 		if (errno == ENOSPC)
 			errx(EXIT_FAILURE, _("%s: cannot add inotify watch "
 				"(limit of inotify watches was reached)."),
-				filename);
+				tf->name);
 
-		err(EXIT_FAILURE, _("%s: cannot add inotify watch."), filename);
+		err(EXIT_FAILURE, _("%s: cannot add inotify watch."), tf->name);
 	}
 
-	while (ffd >= 0) {
-		len = read(fd, buf, sizeof(buf));
+	/* the directory is watched for a new file after rotation */
+	if (p)
+		p[p == dir ? 1 : 0] = '\0';
+	tf->dirwd = inotify_add_watch(ifd, p ? dir : ".", DIR_EVENTS);
+	free(dir);
+}
+
+static void
+file_event(int ifd, struct tailf_file *tf, uint32_t mask)
+{
+	struct stat st;
+
+	if (mask & IN_MODIFY)
+		tf->dirty = 1;
+	if (mask & IN_MOVE_SELF) {
+		/* keep following the old file until there is a new one */
+		tf->moved = 1;
+		tf->dirty = 1;
+		if (is_replaced(tf))
+			reopen_file(tf, ifd);
+	}
+	if ((mask & IN_DELETE_SELF) ||
+	    ((mask & IN_ATTRIB) && fstat(tf->fd, &st) == 0 && st.st_nlink == 0))
+		reopen_file(tf, ifd);
+	else if (mask & IN_UNMOUNT) {
+		close(tf->fd);
+		tf->fd = -1;
+	}
+}
+
+static int
+watch_files_inotify(void)
+{
+	char buf[NEVENTS * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	size_t i;
+	int ifd, e;
+
+	ifd = inotify_init();
+	if (ifd == -1)
+		return 0;
+
+	for (i = 0; i < nfiles; i++)
+		add_watches(ifd, &files[i]);
+
+	while (followed_files()) {
+		len = read(ifd, buf, sizeof(buf));
 		if (len < 0 && (errno == EINTR || errno == EAGAIN))
 			continue;
 		if (len < 0)
 			err(EXIT_FAILURE,
-				_("%s: cannot read inotify events"), filename);
+				_("%s: cannot read inotify events"), files[0].name);
 
 		for (e = 0; e < len; ) {
 			struct inotify_event *ev = (struct inotify_event *) &buf[e];
 
-			if (ev->mask & IN_MODIFY)
-				roll_file(filename, size);
-			else {
-				close(ffd);
-				ffd = -1;
-				break;
+			for (i = 0; i < nfiles; i++) {
+				struct tailf_file *tf = &files[i];
+
+				if (tf->fd >= 0 && ev->wd == tf->wd)
+					file_event(ifd, tf, ev->mask);
+				else if (ev->len && ev->wd == tf->dirwd &&
+					 (tf->fd < 0 || tf->moved) &&
+					 strcmp(ev->name, tf->base) == 0)
+					reopen_file(tf, ifd);
 			}
 			e += sizeof(struct inotify_event) + ev->len;
 		}
+
+		/* all the modifications read at once are copied at once */
+		for (i = 0; i < nfiles; i++) {
+			struct tailf_file *tf = &files[i];
+
+			if (tf->dirty && tf->fd >= 0)
+				roll_file(tf);
+			tf->dirty = 0;
+		}
 	}
-	close(fd);
+	close(ifd);
 	return 1;
 }
 
@@ -195,7 +435,7 @@ static void __attribute__ ((__noreturn__)) usage(FILE *out)
 {
 	fprintf(out,
 		_("\nUsage:\n"
-		  " %s [option] file\n"),
+		  " %s [option] file...\n"),
 		program_invocation_short_name);
 
 	fprintf(out, _(
@@ -231,11 +471,9 @@ static long old_style_option(int *argc, char **argv)
 
 int main(int argc, char **argv)
 {
-	const char *filename;
 	long lines;
+	size_t i;
 	int ch;
-	struct stat st;
-	off_t size = 0;
 
 	static const struct option longopts[] = {
 		{ "lines",   required_argument, 0, 'n' },
@@ -273,19 +511,28 @@ int main(int argc, char **argv)
 	if (argc == optind)
 		errx(EXIT_FAILURE, _("no input file specified"));
 
-	filename = argv[optind];
+	nfiles = argc - optind;
+	files = xcalloc(nfiles, sizeof(struct tailf_file));
 
-	if (stat(filename, &st) != 0)
-		err(EXIT_FAILURE, _("stat failed %s"), filename);
+	for (i = 0; i < nfiles; i++) {
+		struct tailf_file *tf = &files[i];
+		const char *p;
 
-	size = st.st_size;;
-	tailf(filename, lines);
+		tf->name = argv[optind + i];
+		p = strrchr(tf->name, '/');
+		tf->base = p ? p + 1 : tf->name;
+		tf->wd = tf->dirwd = -1;
+
+		tf->fd = open(tf->name, O_RDONLY);
+		if (tf->fd < 0)
+			err(EXIT_FAILURE, _("cannot open %s"), tf->name);
+		tailf(tf, lines);
+	}
 
 #ifdef HAVE_INOTIFY_INIT
-	if (!watch_file_inotify(filename, &size))
+	if (!watch_files_inotify())
 #endif
-		watch_file(filename, &size);
+		watch_files();
 
 	return EXIT_SUCCESS;
 }
-